@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <atomic>
 #include "armv6m.h"
 
 //-----------------------------------------------------------------
@@ -11,13 +12,47 @@
 #define DPRINTF(l,a)        do { if (m_trace & l) printf a; } while (0)
 #define TRACE_ENABLED(l)    (m_trace & l)
 
+// SP / PC operands of 32-bit data processing instructions are
+// UNPREDICTABLE (treated as UNDEFINED)
+#define REG_SP_OR_PC(r)     ((r) == REG_SP || (r) == REG_PC)
+
+// Decode cache entry layout (packed into 64-bits)
+#define DCACHE_GROUP_SHIFT      0
+#define DCACHE_RD_SHIFT         4
+#define DCACHE_RT_SHIFT         8
+#define DCACHE_RM_SHIFT         12
+#define DCACHE_RN_SHIFT         16
+#define DCACHE_COND_SHIFT       20
+#define DCACHE_IMM_SHIFT        24
+#define DCACHE_REGLIST_SHIFT    40
+#define DCACHE_32BIT            (1ULL << 56)
+#define DCACHE_VALID            (1ULL << 63)
+
+//-----------------------------------------------------------------
+// Decode cache: decoded fields per 16-bit opcode.
+// Decode is a pure function of the opcode (other than the 32-bit
+// BL/MSR/MRS prefixes), so one table per architecture variant is
+// shared by all instances in the process. Entries are published with
+// a single atomic store and read without locks.
+//-----------------------------------------------------------------
+static std::atomic<uint64_t> g_decode_cache[2][1 << 16];
+
 //-----------------------------------------------------------------
 // Constructor
 //-----------------------------------------------------------------
 Armv6m::Armv6m(uint32_t baseAddr /*= 0*/, uint32_t len /*= 0*/)
 {
-    m_mem_regions        = 0;
+    memset(m_page_table, 0, sizeof(m_page_table));
+    m_dirty_tracking     = false;
+    m_heat               = NULL;
+    m_mpu                = NULL;
+    m_mpu_active         = false;
+    m_slow_fetch         = PAGE_SLOW_FETCH;
+    m_slow_read          = PAGE_SLOW_READ;
+    m_slow_write         = PAGE_SLOW_WRITE;
     m_has_breakpoints    = false;
+    m_watch_hit_valid    = false;
+    m_arch               = ARCH_V6M;
     m_step_cb            = NULL;
 
     // Some memory defined
@@ -35,21 +70,43 @@ Armv6m::Armv6m(uint32_t baseAddr /*= 0*/, uint32_t len /*= 0*/)
 
     // Dummy System Control Block - writes have no effect, reads return 0
     attach_memory(new DummyDevice(0xE000ED00), 0xE000ED00, 36);
+
+    // MPU (disabled until configured)
+    m_mpu = new Mpu(0xE000ED90);
+    attach_memory(m_mpu, 0xE000ED90, 20);
+
+    for (int r=0;r<MPU_REGIONS;r++)
+        m_mpu_end[r] = m_mpu_base[r] = 0;
+    m_mpu->set_changed_callback(armv6m_mpu_changed, this);
 }
 //-----------------------------------------------------------------
 // Deconstructor
 //-----------------------------------------------------------------
 Armv6m::~Armv6m()
 {
-    for (int m=0;m<m_mem_regions;m++)
+    for (std::vector<tMemRegion>::iterator it = m_regions.begin(); it != m_regions.end(); ++it)
+        delete it->mem;
+    m_regions.clear();
+
+    while (!m_snapshots.empty())
+        snapshot_free(m_snapshots.back());
+
+    for (int i=0;i<PT_L1_ENTRIES;i++)
     {
-        if (m_mem[m])
-            delete m_mem[m];
-        m_mem[m] = NULL;
+        if (!m_page_table[i])
+            continue;
+
+        for (int j=0;j<PT_L2_ENTRIES;j++)
+            delete [] m_page_table[i][j].mmio;
+        delete [] m_page_table[i];
     }
+
+    set_heatmap(false);
 }
 //-----------------------------------------------------------------
 // error: Handle an error
+// Terminal errors stop the CPU, others raise a HardFault once the
+// current instruction completes.
 //-----------------------------------------------------------------
 bool Armv6m::error(bool terminal, const char *fmt, ...)
 {
@@ -59,7 +116,13 @@ bool Armv6m::error(bool terminal, const char *fmt, ...)
     vprintf(fmt, args);
     va_end(args);
 
-    exit(-1);
+    if (terminal)
+    {
+        m_fault       = true;
+        m_stop_reason = STOP_FAULT;
+    }
+    else
+        m_fault_pending = true;
 
     return true;
 }
@@ -68,32 +131,294 @@ bool Armv6m::error(bool terminal, const char *fmt, ...)
 //-----------------------------------------------------------------
 bool Armv6m::create_memory(uint32_t baseAddr, uint32_t len, uint8_t *buf /*=NULL*/)
 {
+    SimpleMemory *mem;
+
     if (buf)
-        return attach_memory(new SimpleMemory(buf, len), baseAddr, len);
+        mem = new SimpleMemory(buf, len);
     else
-        return attach_memory(new SimpleMemory(len), baseAddr, len);
+        mem = new SimpleMemory(len);
+
+    if (attach_memory(mem, baseAddr, len))
+        return true;
+
+    delete mem;
+    return false;
 }
 //-----------------------------------------------------------------
-// attach_memory: Attach a memory device to a particular region
+// attach_memory: Attach a memory device to a particular region.
+// Fails (without taking ownership) if the region overlaps another.
 //-----------------------------------------------------------------
 bool Armv6m::attach_memory(Memory *memory, uint32_t baseAddr, uint32_t len)
 {
-    if (m_mem_regions < MAX_MEM_REGIONS)
+    uint64_t end = (uint64_t)baseAddr + len;
+
+    if (len == 0 || end > 0x100000000ULL)
+        return false;
+
+    // First region after the new one
+    std::vector<tMemRegion>::iterator it = m_regions.begin();
+    int idx = armv6m_find_region(baseAddr);
+    if (idx >= 0)
+        it += idx + 1;
+
+    // Overlap with neighbours?
+    if ((it != m_regions.end() && it->base < end) ||
+        (it != m_regions.begin() && ((uint64_t)(it-1)->base + (it-1)->size) > baseAddr))
     {
-        m_mem_base[m_mem_regions] = baseAddr;
-        m_mem_size[m_mem_regions] = len;
+        const tMemRegion &other = (it != m_regions.end() && it->base < end) ? *it : *(it-1);
+
+        fprintf(stderr, "MEM: Region 0x%08x-0x%08x overlaps 0x%08x-0x%08x\n", 
+                baseAddr, (uint32_t)(end - 1), other.base, other.base + other.size - 1);
+        return false;
+    }
 
-        m_mem[m_mem_regions] = memory;
-        m_mem[m_mem_regions]->reset();
+    tMemRegion region;
+    region.base = baseAddr;
+    region.size = len;
+    region.mem  = memory;
 
-        m_mem_regions++;
+    memory->reset();
+    m_regions.insert(it, region);
+    armv6m_map_pages(region);
 
-        return true;
+    // Device registers dispatched directly from the page table
+    if (!memory->get_buffer())
+    {
+        for (uint32_t offset = 0; offset < len; offset += 4)
+        {
+            tMmioReg reg;
+            if (memory->mmio_reg(offset, &reg))
+                attach_mmio(baseAddr + offset, reg.read, reg.write, reg.ctx, reg.offset);
+        }
     }
 
+    if (!m_watchpoints.empty())
+        armv6m_watch_pages();
+
+    if (m_mpu && (m_mpu->get_ctrl() & MPU_CTRL_ENABLE))
+        armv6m_mpu_pages(baseAddr, end);
+
+    return true;
+}
+//-----------------------------------------------------------------
+// map_memory: Create a memory region backed by a file from offset
+// (size = 0 for the rest of the file). Shared regions write through to
+// the file. Contents are read from the file as pages are touched.
+//-----------------------------------------------------------------
+bool Armv6m::map_memory(uint32_t baseAddr, uint32_t len, const char *filename, bool shared /*=false*/, uint32_t offset /*=0*/)
+{
+    MappedMemory *mem = new MappedMemory(filename, len, shared, offset);
+
+    if (mem->get_buffer() && attach_memory(mem, baseAddr, mem->get_size()))
+        return true;
+
+    delete mem;
+    return false;
+}
+//-----------------------------------------------------------------
+// create_shared_memory: Create a RAM region in a named shared memory
+// object which other processes can map
+//-----------------------------------------------------------------
+bool Armv6m::create_shared_memory(uint32_t baseAddr, uint32_t len, const char *name)
+{
+    SharedMemory *mem = new SharedMemory(name, len);
+
+    if (mem->get_buffer() && attach_memory(mem, baseAddr, len))
+        return true;
+
+    delete mem;
+    return false;
+}
+//-----------------------------------------------------------------
+// create_rom: Create a read-only region from an image. Regions created
+// with the same key (in any instance) share one copy of the image, so
+// must be the same size - a key already in use with another fails.
+// cow: writes give this instance a private copy instead of faulting.
+//-----------------------------------------------------------------
+bool Armv6m::create_rom(uint32_t baseAddr, uint32_t len, const uint8_t *image, const char *key, bool cow /*=false*/)
+{
+    RomMemory *mem = new RomMemory(key, image, len, cow);
+
+    if (mem->get_buffer() && attach_memory(mem, baseAddr, len))
+        return true;
+
+    delete mem;
+    return false;
+}
+//-----------------------------------------------------------------
+// map_rom: Create a read-only region mapped from offset in a file
+// (contents not copied - shared through the page cache).
+// cow: writes give this instance a private copy instead of faulting.
+//-----------------------------------------------------------------
+bool Armv6m::map_rom(uint32_t baseAddr, uint32_t len, const char *filename, uint32_t offset, bool cow /*=false*/)
+{
+    RomMemory *mem = new RomMemory(filename, offset, len, cow);
+
+    if (mem->get_buffer() && attach_memory(mem, baseAddr, len))
+        return true;
+
+    delete mem;
     return false;
 }
 //-----------------------------------------------------------------
+// attach_mmio: Bind handlers to a 32-bit register of an attached
+// device (replacing any existing binding). Narrower accesses still go
+// to the device.
+//-----------------------------------------------------------------
+bool Armv6m::attach_mmio(uint32_t addr, FP_MMIO_READ read, FP_MMIO_WRITE write, void *ctx, uint32_t offset /*= 0*/)
+{
+    uint32_t mem_offset;
+    Memory *mem = armv6m_lookup(addr, &mem_offset);
+
+    if ((addr & 3) || !ctx || !mem || mem->get_buffer())
+        return false;
+
+    tPage *page = armv6m_page(addr);
+    if (!page->mmio)
+    {
+        page->mmio = new tMmioReg[PAGE_MMIO_REGS];
+        memset(page->mmio, 0, sizeof(tMmioReg) * PAGE_MMIO_REGS);
+    }
+
+    tMmioReg *reg = &page->mmio[(addr & PAGE_MASK) >> 2];
+    reg->read   = read;
+    reg->write  = write;
+    reg->ctx    = ctx;
+    reg->offset = offset;
+    return true;
+}
+//-----------------------------------------------------------------
+// armv6m_map_pages: Add a region to the page table.
+// Pages touched by more than one region are marked mixed and resolved
+// by searching the regions.
+//-----------------------------------------------------------------
+void Armv6m::armv6m_map_pages(const tMemRegion &region)
+{
+    uint64_t base = region.base;
+    uint64_t end  = base + region.size;
+
+    for (uint64_t addr = base & ~(uint64_t)PAGE_MASK; addr < end; addr += PAGE_SIZE)
+    {
+        tPage *&l2 = m_page_table[addr >> PT_L1_SHIFT];
+        if (!l2)
+        {
+            l2 = new tPage[PT_L2_ENTRIES];
+            memset(l2, 0, sizeof(tPage) * PT_L2_ENTRIES);
+        }
+
+        tPage *page = &l2[(addr >> PAGE_SHIFT) & (PT_L2_ENTRIES - 1)];
+
+        if (page->mem || (page->flags & PAGE_MIXED))
+        {
+            page->mem   = NULL;
+            page->host  = NULL;
+            page->flags = (page->flags & ~PAGE_RO) | PAGE_MIXED;
+        }
+        else
+        {
+            page->mem  = region.mem;
+            page->base = region.base;
+            page->size = region.size;
+            page->host = region.mem->get_buffer();
+
+            if (region.mem->read_only())
+                page->flags |= PAGE_RO;
+        }
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_find_region: Index of the last region starting at or below
+// an address (-1 if none). O(log n).
+//-----------------------------------------------------------------
+int Armv6m::armv6m_find_region(uint32_t address)
+{
+    int lo = 0;
+    int hi = (int)m_regions.size() - 1;
+    int found = -1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (m_regions[mid].base <= address)
+        {
+            found = mid;
+            lo    = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    return found;
+}
+//-----------------------------------------------------------------
+// armv6m_page_write: Store to a page with write tracking flags set.
+// Returns false (and raises a fault) if the page is read-only.
+//-----------------------------------------------------------------
+bool Armv6m::armv6m_page_write(uint32_t address)
+{
+    tPage *page = armv6m_page(address);
+    if (!page)
+        return true;
+
+    if ((page->flags & PAGE_RO) && (address - page->base) < page->size)
+    {
+        error(false, "Write to read-only memory @ 0x%08x\n", address);
+        return false;
+    }
+
+    armv6m_page_modify(address);
+    return true;
+}
+//-----------------------------------------------------------------
+// armv6m_page_modify: Page contents about to change - save it to any
+// snapshots and mark it dirty
+//-----------------------------------------------------------------
+void Armv6m::armv6m_page_modify(uint32_t address)
+{
+    tPage *page = armv6m_page(address);
+    if (!page)
+        return ;
+
+    if (page->flags & PAGE_COW)
+        armv6m_snapshot_page(address);
+
+    page->flags &= ~PAGE_CLEAN;
+}
+//-----------------------------------------------------------------
+// armv6m_page_flags: Set / clear a flag on all pages with memory
+//-----------------------------------------------------------------
+void Armv6m::armv6m_page_flags(uint32_t flag, bool set)
+{
+    for (int i=0;i<PT_L1_ENTRIES;i++)
+    {
+        tPage *l2 = m_page_table[i];
+        if (!l2)
+            continue;
+
+        for (int j=0;j<PT_L2_ENTRIES;j++)
+        {
+            if (!set)
+                l2[j].flags &= ~flag;
+            else if (l2[j].host || (l2[j].flags & PAGE_MIXED))
+                l2[j].flags |= flag;
+        }
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_lookup_mixed: Slow lookup for pages shared by regions
+//-----------------------------------------------------------------
+Memory *Armv6m::armv6m_lookup_mixed(uint32_t address, uint32_t *offset)
+{
+    int idx = armv6m_find_region(address);
+
+    if (idx < 0 || (address - m_regions[idx].base) >= m_regions[idx].size)
+        return NULL;
+
+    *offset = address - m_regions[idx].base;
+    return m_regions[idx].mem;
+}
+//-----------------------------------------------------------------
 // set_pc: Set PC
 //-----------------------------------------------------------------
 void Armv6m::set_pc(uint32_t pc)
@@ -184,24 +509,23 @@ bool Armv6m::check_breakpoint(uint32_t pc)
 void Armv6m::reset(uint32_t start_addr)
 {
     m_fault       = false;
+    m_fault_pending = false;
+    m_inst_count  = 0;
+    m_memo_profiling = false;
     m_break       = false;
+    m_watch_hit_valid = false;
+    m_stop_reason = STOP_NONE;
+    m_exit_code   = 0;
     m_trace       = 0;
+    m_trace_apsr  = 0;
+    m_systick_irq = false;
 
     for (int i=0;i<REGISTERS;i++)
         m_regfile[i] = 0; 
 
     m_apsr = 0;
 
-    m_entry_point = start_addr;
-
-    // Fetch SP & boot PC from vector table
-    m_regfile[REG_SP] = read32(m_entry_point); 
-    m_regfile[REG_LR] = 0;
-    m_regfile[REG_PC] = read32(m_entry_point + 4) & ~1;
-
-    // Start in thread mode with main stack selected
-    m_msp = m_regfile[REG_SP];
-    m_psp = 0;
+    // Start in privileged thread mode with main stack selected
     m_current_mode = MODE_THREAD;
     m_control = 0; // (SPSEL = 0, nPRIV = 0)
     m_primask = 0;
@@ -209,105 +533,372 @@ void Armv6m::reset(uint32_t start_addr)
     // Misc
     m_ipsr = 0;
     m_epsr = 0;
+
+    // MPU disabled, regions cleared
+    if (m_mpu)
+        m_mpu->reset();
+    armv6m_mpu_update();
+
+    m_entry_point = start_addr;
+
+    // Fetch SP & boot PC from vector table
+    m_regfile[REG_SP] = armv6m_read_vector(0);
+    m_regfile[REG_LR] = 0;
+    m_regfile[REG_PC] = armv6m_read_vector(1) & ~1;
+
+    m_msp = m_regfile[REG_SP];
+    m_psp = 0;
 }
 //-----------------------------------------------------------------
 // valid_addr: Check if the physical memory address is valid
 //-----------------------------------------------------------------
 bool Armv6m::valid_addr(uint32_t address)
 {
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
-            return true;
+    uint32_t offset;
+    return armv6m_lookup(address, &offset) != NULL;
+}
+//-----------------------------------------------------------------
+// set_heatmap: Enable / disable (and discard) per-page access counts.
+// The table covers the whole address space but is anonymous memory,
+// so only pages of it which are counted into are allocated.
+//-----------------------------------------------------------------
+bool Armv6m::set_heatmap(bool enable)
+{
+    if (enable == (m_heat != NULL))
+        return true;
 
-    return false;
+    if (!enable)
+    {
+        munmap(m_heat, HEAT_PAGES * sizeof(tHeat));
+        m_heat = NULL;
+        return true;
+    }
+
+    void *heat = mmap(NULL, HEAT_PAGES * sizeof(tHeat), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heat == MAP_FAILED)
+        return false;
+
+    m_heat = (tHeat *)heat;
+    return true;
 }
 //-----------------------------------------------------------------
-// write: Write a byte to memory (physical address)
+// armv6m_load: Typed load (physical address). Signed types sign
+// extend. Unaligned accesses fault. Not counted in the heatmap.
 //-----------------------------------------------------------------
-void Armv6m::write(uint32_t address, uint8_t data)
+template <typename T> T Armv6m::armv6m_load(uint32_t address, tAccess access)
 {
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
+    T data = 0;
+
+    // No unaligned access support on ARMv6-M
+    if (address & (sizeof(T) - 1))
+    {
+        error(false, "Unaligned %s @ 0x%08x\n", access == ACCESS_FETCH ? "fetch" : "load", address);
+        return data;
+    }
+
+    // Data reads only - instruction fetches are not function inputs
+    if (m_memo_profiling && access == ACCESS_READ)
+        armv6m_memo_load(address);
+
+    uint8_t *host = armv6m_host_addr(address, access == ACCESS_FETCH ? m_slow_fetch : m_slow_read);
+    if (host)
+        memcpy(&data, host, sizeof(T));
+    else if (!m_mpu_active || armv6m_mpu_check(address, access))
+    {
+        uint32_t offset;
+        tMmioReg *reg;
+        Memory *mem;
+
+        // Bound device register, else the region's memory / device
+        if (sizeof(T) == 4 && (reg = armv6m_mmio(address)) != NULL)
+            data = reg->read ? (T)reg->read(reg->ctx, reg->offset) : 0;
+        else if ((mem = armv6m_lookup(address, &offset)) != NULL && !(sizeof(T) != 4 && mem->word_only()))
+            data = mem->load<T>(offset);
+        else
         {
-            m_mem[j]->store(address - m_mem_base[j], data, 1);
-            return ;
+            error(false, "Failed %s @ 0x%08x\n", access == ACCESS_FETCH ? "fetch" : "load", address);
+            return data;
         }
 
-    error(false, "Failed store @ 0x%08x\n", address);
+        if (access == ACCESS_READ)
+            armv6m_watch_check(address, sizeof(T), (uint32_t)data, WATCH_READ);
+    }
+
+    DPRINTF(LOG_MEM, ("MEM: Read%d %08x = %08x\n", (int)sizeof(T) * 8, address, (uint32_t)data));
+    return data;
 }
 //-----------------------------------------------------------------
-// write32: Write a word to memory
+// load: Typed load (physical address)
 //-----------------------------------------------------------------
-void Armv6m::write32(uint32_t address, uint32_t data)
+template <typename T> T Armv6m::load(uint32_t address)
 {
-    DPRINTF(LOG_MEM, ("MEM: Write32 %x = %x\n", address, data));
+    if (m_heat)
+        m_heat[address >> PAGE_SHIFT].reads++;
 
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
-        {
-            m_mem[j]->store(address - m_mem_base[j], data, 4);
+    return armv6m_load<T>(address, ACCESS_READ);
+}
+//-----------------------------------------------------------------
+// store: Typed store (physical address). Unaligned accesses fault.
+//-----------------------------------------------------------------
+template <typename T> void Armv6m::store(uint32_t address, T data)
+{
+    // No unaligned access support on ARMv6-M
+    if (address & (sizeof(T) - 1))
+    {
+        error(false, "Unaligned store @ 0x%08x\n", address);
+        return ;
+    }
+
+    if (m_heat)
+        m_heat[address >> PAGE_SHIFT].writes++;
+
+    DPRINTF(LOG_MEM, ("MEM: Write%d %08x = %08x\n", (int)sizeof(T) * 8, address, (uint32_t)data));
+
+    if (!m_memo_funcs.empty())
+        armv6m_memo_store(address);
+
+    uint8_t *host = armv6m_host_addr(address, m_slow_write);
+
+    // First write to a tracked page (snapshot / dirty) - then retry.
+    // Watched pages stay on the slow path, so the watch check is made
+    // below once the store has been done.
+    if (!host)
+    {
+        if (m_mpu_active && !armv6m_mpu_check(address, ACCESS_WRITE))
             return ;
-        }
+
+        if (!armv6m_page_write(address))
+            return ;
+
+        host = armv6m_host_addr(address, m_slow_write);
+    }
+
+    if (host)
+    {
+        memcpy(host, &data, sizeof(T));
+        return ;
+    }
+
+    tMmioReg *reg;
+    if (sizeof(T) == 4 && (reg = armv6m_mmio(address)) != NULL)
+    {
+        if (reg->write)
+            reg->write(reg->ctx, reg->offset, (uint32_t)data);
+
+        armv6m_watch_check(address, sizeof(T), (uint32_t)data, WATCH_WRITE);
+        return ;
+    }
+
+    uint32_t offset;
+    Memory *mem = armv6m_lookup(address, &offset);
+    if (mem && mem->read_only())
+    {
+        error(false, "Write to read-only memory @ 0x%08x\n", address);
+        return ;
+    }
+    else if (mem && !(sizeof(T) != 4 && mem->word_only()))
+    {
+        mem->store<T>(offset, data);
+        armv6m_watch_check(address, sizeof(T), (uint32_t)data, WATCH_WRITE);
+        return ;
+    }
 
     error(false, "Failed store @ 0x%08x\n", address);
 }
+
+template uint8_t  Armv6m::load<uint8_t>(uint32_t address);
+template uint16_t Armv6m::load<uint16_t>(uint32_t address);
+template uint32_t Armv6m::load<uint32_t>(uint32_t address);
+template int8_t   Armv6m::load<int8_t>(uint32_t address);
+template int16_t  Armv6m::load<int16_t>(uint32_t address);
+template void     Armv6m::store<uint8_t>(uint32_t address, uint8_t data);
+template void     Armv6m::store<uint16_t>(uint32_t address, uint16_t data);
+template void     Armv6m::store<uint32_t>(uint32_t address, uint32_t data);
+
+//-----------------------------------------------------------------
+// write: Write a byte to memory (physical address)
+//-----------------------------------------------------------------
+void Armv6m::write(uint32_t address, uint8_t data)
+{
+    store<uint8_t>(address, data);
+}
+//-----------------------------------------------------------------
+// write32: Write a word to memory
+//-----------------------------------------------------------------
+void Armv6m::write32(uint32_t address, uint32_t data)
+{
+    store<uint32_t>(address, data);
+}
 //-----------------------------------------------------------------
 // write_mem: Write to memory
 //-----------------------------------------------------------------
 void Armv6m::write_mem(uint32_t address, uint32_t data, int width)
 {
-    DPRINTF(LOG_MEM, ("MEM: Write32 %x = %x (width %d)\n", address, data, width));
-
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
-        {
-            m_mem[j]->store(address - m_mem_base[j], data, width);
-            return ;
-        }
-
-    error(false, "Failed store @ 0x%08x\n", address);
+    switch (width)
+    {
+        case 1:
+            store<uint8_t>(address, data);
+        break;
+        case 2:
+            store<uint16_t>(address, data);
+        break;
+        default:
+            store<uint32_t>(address, data);
+        break;
+    }
 }
 //-----------------------------------------------------------------
 // read_mem: Read a word from memory
 //-----------------------------------------------------------------
 uint32_t Armv6m::read_mem(uint32_t address, int width)
 {
-    if (width == 4)
-        address &= ~3;
-
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
-            return m_mem[j]->load(address - m_mem_base[j], width, false);
-
-    return 0;
+    switch (width)
+    {
+        case 1:
+            return load<uint8_t>(address);
+        case 2:
+            return load<uint16_t>(address);
+        default:
+            return load<uint32_t>(address);
+    }
 }
 //-----------------------------------------------------------------
 // read: Read a byte from memory (physical address)
 //-----------------------------------------------------------------
 uint8_t Armv6m::read(uint32_t address)
 {
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
-            return m_mem[j]->load(address - m_mem_base[j], 1, false);
-
-    return 0;
+    return load<uint8_t>(address);
 }
 //-----------------------------------------------------------------
 // read32: Read a word from memory (physical address)
 //-----------------------------------------------------------------
 uint32_t Armv6m::read32(uint32_t address)
 {
-    address &= ~3;
+    return load<uint32_t>(address);
+}
+//-----------------------------------------------------------------
+// read_block: Read a block of memory (debugger / loaders).
+// Plain memory is copied a page at a time, devices are read a word at
+// a time (each word touched read once). Unmapped bytes read as zero.
+// Returns false if any were.
+//-----------------------------------------------------------------
+bool Armv6m::read_block(uint32_t address, uint8_t *dst, uint32_t len)
+{
+    bool ok = true;
+
+    while (len)
+    {
+        uint32_t chunk = PAGE_SIZE - (address & PAGE_MASK);
+        if (chunk > len)
+            chunk = len;
+
+        tPage   *page = armv6m_page(address);
+        uint32_t offset;
+        Memory  *mem;
 
-    for (int j=0;j<m_mem_regions;j++)
-        if (address >= m_mem_base[j] && address < (m_mem_base[j] + m_mem_size[j]))
+        if (page && page->host && !(page->flags & PAGE_MIXED) && (address - page->base) < page->size)
         {
-            uint32_t data = m_mem[j]->load(address - m_mem_base[j], 4, false);
-            DPRINTF(LOG_MEM, ("MEM: Read32 %08x = %08x\n", address, data));
-            return data;
+            offset = address - page->base;
+            if (chunk > page->size - offset)
+                chunk = page->size - offset;
+
+            memcpy(dst, page->host + offset, chunk);
         }
+        else if ((mem = armv6m_lookup(address, &offset)) != NULL)
+        {
+            uint32_t word = mem->load(offset & ~3, 4, false);
 
-    return 0;
+            // Bytes wanted from this word
+            chunk = 4 - (address & 3);
+            if (chunk > len)
+                chunk = len;
+
+            for (uint32_t i = 0; i < chunk; i++)
+                dst[i] = word >> (((address & 3) + i) * 8);
+        }
+        else
+        {
+            chunk   = 1;
+            dst[0]  = 0;
+            ok      = false;
+        }
+
+        address += chunk;
+        dst     += chunk;
+        len     -= chunk;
+    }
+
+    return ok;
+}
+//-----------------------------------------------------------------
+// write_block: Write a block of memory (debugger / loaders).
+// Debug writes are permitted to read-only memory. Devices are written
+// whole words only. Returns false if any of the block is unmapped
+// or is part of a device word (not written).
+//-----------------------------------------------------------------
+bool Armv6m::write_block(uint32_t address, const uint8_t *src, uint32_t len)
+{
+    bool ok = true;
+
+    while (len)
+    {
+        uint32_t chunk = PAGE_SIZE - (address & PAGE_MASK);
+        if (chunk > len)
+            chunk = len;
+
+        tPage   *page = armv6m_page(address);
+        uint32_t offset;
+        Memory  *mem;
+
+        if (page && page->host && !(page->flags & PAGE_MIXED) && (address - page->base) < page->size)
+        {
+            offset = address - page->base;
+            if (chunk > page->size - offset)
+                chunk = page->size - offset;
+
+            armv6m_page_modify(address);
+            memcpy(page->host + offset, src, chunk);
+        }
+        else if ((mem = armv6m_lookup(address, &offset)) != NULL)
+        {
+            armv6m_page_modify(address);
+
+            // Whole words where possible (devices only support words)
+            if (!(address & 3) && chunk >= 4)
+            {
+                uint32_t word;
+                memcpy(&word, src, 4);
+                mem->store(offset, word, 4);
+                chunk = 4;
+            }
+            else if (!mem->word_only())
+            {
+                mem->store(offset, src[0], 1);
+                chunk = 1;
+            }
+            else
+            {
+                chunk = 1;
+                ok    = false;
+            }
+        }
+        else
+        {
+            chunk = 1;
+            ok    = false;
+        }
+
+        // Discard memoised results which read this memory
+        if (!m_memo_funcs.empty())
+            for (uint32_t a = address & ~3; a < address + chunk; a += 4)
+                armv6m_memo_store(a);
+
+        address += chunk;
+        src     += chunk;
+        len     -= chunk;
+    }
+
+    return ok;
 }
 //-----------------------------------------------------------------
 // get_opcode: Get instruction from address
@@ -324,16 +915,35 @@ void Armv6m::step(void)
     uint16_t inst;
     uint16_t inst2;
     int inst_32_bit;
+    uint32_t inst_pc;
+
+    // Halted (exit or lockup) - needs a reset()
+    if (m_stop_reason != STOP_NONE)
+        return ;
 
     // EXC_RETURN value in PC
     if ((m_regfile[REG_PC] & EXC_RETURN) == EXC_RETURN)
+    {
         armv6m_exc_return(m_regfile[REG_PC]);
 
+        // Bad return value / unstacking fault
+        if (m_fault_pending)
+        {
+            armv6m_hardfault(m_regfile[REG_PC]);
+            return ;
+        }
+    }
+
+    // Memoised function entry / return
+    if (!m_memo_funcs.empty())
+        armv6m_memo_check();
+
     // Fetch
-    inst = armv6m_read_inst(m_regfile[REG_PC]);
+    inst_pc = m_regfile[REG_PC];
+    inst = armv6m_read_inst(inst_pc);
 
     // Decode
-    inst_32_bit = armv6m_decode(inst);
+    inst_32_bit = armv6m_decode_cached(inst);
 
     // [32-bit instruction] Fetch another half word
     if (inst_32_bit)
@@ -344,10 +954,11 @@ void Armv6m::step(void)
     DPRINTF(LOG_FETCH, ("%08X: 0x%04X \n",m_regfile[REG_PC],inst));
     
     if (TRACE_ENABLED(LOG_INST))
-        armv6m_dump_inst(inst);
+        armv6m_dump_inst(inst, inst2);
 
-    // Execute
-    armv6m_execute(inst, inst2);
+    // Execute (unless the fetch faulted)
+    if (!m_fault_pending)
+        armv6m_execute(inst, inst2);
 
     if (TRACE_ENABLED(LOG_REGISTERS))
     {
@@ -368,29 +979,30 @@ void Armv6m::step(void)
 
     if (TRACE_ENABLED(LOG_FLAGS))
     {
-        static uint32_t old_apsr = 0;
-
-        if (m_apsr != old_apsr)
+        if (m_apsr != m_trace_apsr)
         {
             printf("%08X: Flags = %c%c%c%c\n", m_regfile[REG_PC],
                                     m_apsr & APSR_N ? 'N':'-', 
                                      m_apsr & APSR_Z ? 'Z':'-',
                                      m_apsr & APSR_C ? 'C':'-',
                                      m_apsr & APSR_V ? 'V':'-');
-            old_apsr = m_apsr;
+            m_trace_apsr = m_apsr;
         }
     }
 
+    // Fault raised by this instruction (UDF, bad access, ...)
+    if (m_fault_pending)
+        armv6m_hardfault(inst_pc);
+
     // Systick
-    static bool systick_irq = false;
     if (m_systick->clock() != -1)
-        systick_irq = true;
+        m_systick_irq = true;
 
     // TODO: Verify likely to be incorrect...
-    if (systick_irq && (m_current_mode == MODE_THREAD) && !(m_primask & PRIMASK_PM))
+    if (m_systick_irq && (m_current_mode == MODE_THREAD) && !(m_primask & PRIMASK_PM))
     {
         m_regfile[REG_PC] = armv6m_exception(m_regfile[REG_PC], 15);
-        systick_irq = false;
+        m_systick_irq = false;
     }
 
     // Dump state
@@ -405,6 +1017,8 @@ void Armv6m::step(void)
         }
     }
 
+    m_inst_count++;
+
     // Breakpoint hit?
     if (m_has_breakpoints && check_breakpoint(get_pc()))
         m_break = true;
@@ -425,14 +1039,10 @@ void Armv6m::set_interrupt(int irq)
 //-------------------------------------------------------------------
 uint16_t Armv6m::armv6m_read_inst(uint32_t addr)
 {
-    uint32_t val = 0;
-    
-    if (addr & 0x2)
-        val = (read32(addr) >> 16) & 0xFFFF;
-    else
-        val = (read32(addr) >> 0) & 0xFFFF;
+    if (m_heat)
+        m_heat[addr >> PAGE_SHIFT].fetches++;
 
-    return val;
+    return armv6m_load<uint16_t>(addr, ACCESS_FETCH);
 }
 //-------------------------------------------------------------------
 // armv6m_update_sp:
@@ -662,16 +1272,26 @@ uint32_t Armv6m::armv6m_sign_extend(uint32_t val, int offset)
     return val;
 }
 //-------------------------------------------------------------------
-// armv6m_dump_inst:
+// armv6m_dump_inst: inst2 is the second half word of 32-bit forms
 //-------------------------------------------------------------------
-void Armv6m::armv6m_dump_inst(uint16_t inst)
+void Armv6m::armv6m_dump_inst(uint16_t inst, uint16_t inst2)
 {
     int i = 0;
 
+    // BL and B.W share a first half word (BL is listed first), B.W has
+    // bit 14 of the second clear - skip the BL entry to find it
+    bool b_w = (inst & INST_B_W_MASK) == INST_B_W_OPCODE && !(inst2 & (1 << 14));
+
     while (instr_details[i].desc)
     {
         if ((inst & instr_details[i].mask) == instr_details[i].opcode)
         {
+            if (b_w && !strcmp(instr_details[i].desc, "BL <label>"))
+            {
+                i++;
+                continue;
+            }
+
             DPRINTF(LOG_INST, (" %x: %s\n", m_regfile[REG_PC], instr_details[i].desc));
             break;
         }
@@ -687,6 +1307,9 @@ uint32_t Armv6m::armv6m_exception(uint32_t pc, uint32_t exception)
 {
     uint32_t sp;
 
+    // Handler code is not part of a memoised call - abandon profile
+    m_memo_profiling = false;
+
     // Retrieve shadow stack pointer (depending on mode)
     if ((m_control & CONTROL_SPSEL) && (m_current_mode == MODE_THREAD))
         sp = m_psp;
@@ -695,28 +1318,28 @@ uint32_t Armv6m::armv6m_exception(uint32_t pc, uint32_t exception)
 
     // Push frame onto current stack
     sp-=4;
-    write32(sp, m_apsr);
+    store<uint32_t>(sp, m_apsr | m_ipsr | m_epsr);
     sp-=4;
-    write32(sp, m_regfile[REG_PC]);
+    store<uint32_t>(sp, m_regfile[REG_PC]);
     sp-=4;
-    write32(sp, m_regfile[REG_LR]);
+    store<uint32_t>(sp, m_regfile[REG_LR]);
     sp-=4; 
-    write32(sp, m_regfile[12]);
+    store<uint32_t>(sp, m_regfile[12]);
     sp-=4; 
-    write32(sp, m_regfile[3]);
+    store<uint32_t>(sp, m_regfile[3]);
     sp-=4; 
-    write32(sp, m_regfile[2]);
+    store<uint32_t>(sp, m_regfile[2]);
     sp-=4; 
-    write32(sp, m_regfile[1]);
+    store<uint32_t>(sp, m_regfile[1]);
     sp-=4; 
-    write32(sp, m_regfile[0]);
+    store<uint32_t>(sp, m_regfile[0]);
     m_regfile[REG_SP] = sp;
 
     // Record exception
     m_ipsr = exception & 0x3F;
 
     // Fetch exception vector address into PC
-    m_regfile[REG_PC] = read32(m_entry_point + (exception * 4)) & ~1;
+    m_regfile[REG_PC] = armv6m_read_vector(exception) & ~1;
 
     // LR = Return to handler mode (recursive interrupt?)
     if (m_current_mode == MODE_HANDLER)
@@ -737,9 +1360,55 @@ uint32_t Armv6m::armv6m_exception(uint32_t pc, uint32_t exception)
     // Current stack is now main
     m_control &= ~CONTROL_SPSEL;
 
+    // Privileged
+    armv6m_mpu_update();
+
     return m_regfile[REG_PC];
 }
 //-------------------------------------------------------------------
+// armv6m_hardfault: Take a HardFault for the instruction at 'pc'.
+// A fault with no handler, or within the HardFault handler itself,
+// locks up the CPU (stop with STOP_FAULT).
+//-------------------------------------------------------------------
+void Armv6m::armv6m_hardfault(uint32_t pc)
+{
+    m_fault_pending = false;
+
+    // Stacked PC is the faulting instruction
+    m_regfile[REG_PC] = pc;
+
+    if ((m_current_mode == MODE_HANDLER && m_ipsr == EXC_HARDFAULT) ||
+        !armv6m_read_vector(EXC_HARDFAULT))
+    {
+        m_fault       = true;
+        m_stop_reason = STOP_FAULT;
+        return ;
+    }
+
+    m_regfile[REG_PC] = armv6m_exception(pc, EXC_HARDFAULT);
+
+    // Fault whilst stacking
+    if (m_fault_pending)
+    {
+        m_fault_pending = false;
+        m_fault         = true;
+        m_stop_reason   = STOP_FAULT;
+    }
+}
+//-------------------------------------------------------------------
+// armv6m_read_vector: Read a vector table entry. Vector reads are not
+// subject to the MPU (or watchpoints). Unreadable entries are zero.
+//-------------------------------------------------------------------
+uint32_t Armv6m::armv6m_read_vector(uint32_t exception)
+{
+    uint32_t value = 0;
+
+    if (!read_block(m_entry_point + (exception * 4), (uint8_t *)&value, sizeof(value)))
+        return 0;
+
+    return value;
+}
+//-------------------------------------------------------------------
 // armv6m_exc_return: Handle returning from an exception
 //-------------------------------------------------------------------
 void Armv6m::armv6m_exc_return(uint32_t pc)
@@ -765,39 +1434,100 @@ void Armv6m::armv6m_exc_return(uint32_t pc)
         case 0x9:
             m_current_mode = MODE_THREAD;
             m_control &= ~CONTROL_SPSEL;
+            m_ipsr = 0;
             break;
         // Return to thread mode (with process stack)
         case 0xD:
             m_current_mode = MODE_THREAD;
             m_control |= CONTROL_SPSEL;
+            m_ipsr = 0;
             break;
         default:
-            assert(!"Not handled");
-            break;
+            error(false, "Bad EXC_RETURN 0x%08x\n", pc);
+            return ;
         }
 
+        // Unstack with the privilege of the mode returned to
+        armv6m_mpu_update();
+
         // Pop exception context
         sp = m_regfile[REG_SP];
-        m_regfile[0] = read32(sp); 
+        m_regfile[0] = load<uint32_t>(sp); 
         sp+=4;
-        m_regfile[1] = read32(sp); 
+        m_regfile[1] = load<uint32_t>(sp); 
         sp+=4;
-        m_regfile[2] = read32(sp); 
+        m_regfile[2] = load<uint32_t>(sp); 
         sp+=4;
-        m_regfile[3] = read32(sp); 
+        m_regfile[3] = load<uint32_t>(sp); 
         sp+=4;
-        m_regfile[12] = read32(sp);
+        m_regfile[12] = load<uint32_t>(sp);
         sp+=4;
-        m_regfile[REG_LR] = read32(sp);
+        m_regfile[REG_LR] = load<uint32_t>(sp);
         sp+=4;
-        m_regfile[REG_PC] = read32(sp);
+        m_regfile[REG_PC] = load<uint32_t>(sp);
         sp+=4;
-        m_apsr = read32(sp);
+        uint32_t xpsr = load<uint32_t>(sp);
         sp+=4;
         armv6m_update_sp(sp);
+
+        m_apsr = xpsr & 0xF8000000;
+
+        // Exception being returned to (nested)
+        if (m_current_mode == MODE_HANDLER)
+        {
+            m_ipsr = xpsr & 0x3F;
+            armv6m_mpu_update();
+        }
     }
 }
 //-------------------------------------------------------------------
+// armv6m_decode_cached: Decode using the shared decode cache
+// Returns:
+//  0 = 16-bit instruction, execute
+//  1 = 32-bit instruction, fetch next word
+//-------------------------------------------------------------------
+int Armv6m::armv6m_decode_cached(uint16_t inst)
+{
+    // 32-bit prefixes (BL, B.W, MSR, MRS, MOVW, ...) peek at the
+    // next half word - not cacheable
+    if ((inst & INST_IGRP1_MASK) == INST_BL_OPCODE)
+        return armv6m_decode(inst);
+
+    uint64_t entry = g_decode_cache[m_arch][inst].load(std::memory_order_relaxed);
+
+    // Miss: full decode then publish
+    if (!(entry & DCACHE_VALID))
+    {
+        int res = armv6m_decode(inst);
+
+        entry = DCACHE_VALID;
+        entry|= (uint64_t)m_inst_group << DCACHE_GROUP_SHIFT;
+        entry|= (uint64_t)m_rd         << DCACHE_RD_SHIFT;
+        entry|= (uint64_t)m_rt         << DCACHE_RT_SHIFT;
+        entry|= (uint64_t)m_rm         << DCACHE_RM_SHIFT;
+        entry|= (uint64_t)m_rn         << DCACHE_RN_SHIFT;
+        entry|= (uint64_t)m_cond       << DCACHE_COND_SHIFT;
+        entry|= (uint64_t)m_imm        << DCACHE_IMM_SHIFT;
+        entry|= (uint64_t)m_reglist    << DCACHE_REGLIST_SHIFT;
+        if (res)
+            entry |= DCACHE_32BIT;
+
+        g_decode_cache[m_arch][inst].store(entry, std::memory_order_relaxed);
+        return res;
+    }
+
+    m_inst_group = (entry >> DCACHE_GROUP_SHIFT)   & 0xF;
+    m_rd         = (entry >> DCACHE_RD_SHIFT)      & 0xF;
+    m_rt         = (entry >> DCACHE_RT_SHIFT)      & 0xF;
+    m_rm         = (entry >> DCACHE_RM_SHIFT)      & 0xF;
+    m_rn         = (entry >> DCACHE_RN_SHIFT)      & 0xF;
+    m_cond       = (entry >> DCACHE_COND_SHIFT)    & 0xF;
+    m_imm        = (entry >> DCACHE_IMM_SHIFT)     & 0xFFFF;
+    m_reglist    = (entry >> DCACHE_REGLIST_SHIFT) & 0xFFFF;
+
+    return (entry & DCACHE_32BIT) ? 1 : 0;
+}
+//-------------------------------------------------------------------
 // armv6m_decode: Decode ARMv6m instruction
 // Returns:
 //  0 = 16-bit instruction, execute
@@ -827,6 +1557,13 @@ int Armv6m::armv6m_decode(uint16_t inst)
             // 1 1 0 1 cond imm8
             case INST_BCC_OPCODE:
             {
+                // Condition 14 is UDF, 15 is SVC (group 3)
+                if (((inst >> 8) & 0x0F) >= 14)
+                {
+                    v_decoded = 0;
+                    break;
+                }
+
                 m_cond = (inst >> 8) & 0x0F;
                 m_imm  = (inst >> 0) & 0xFF;
             }
@@ -896,6 +1633,9 @@ int Armv6m::armv6m_decode(uint16_t inst)
             // BL - BL <label>
             // 1 1 1 01 S imm10 1 1 J1 1 J2 imm11
             case INST_BL_OPCODE:
+            // B.W - B.W <label> (ARMv8-M Baseline)
+            // 1 1 1 1 0 S imm10 1 0 J1 1 J2 imm11
+            //case INST_B_W_OPCODE:
             {
                 // 32-bit instruction
                 res = 1;
@@ -903,9 +1643,15 @@ int Armv6m::armv6m_decode(uint16_t inst)
                 m_rd = REG_LR; // Implicit
 
                 // TODO: Clean this up
-                // Check next instruction to work out if this is a BL or MSR
-                if ((armv6m_read_inst(m_regfile[REG_PC]+2) & 0xC000) != 0xC000)
-                    v_decoded = 0;
+                // Check next instruction to work out if this is a BL, B.W or MSR
+                uint16_t next = armv6m_read_inst(m_regfile[REG_PC]+2);
+                if ((next & 0xC000) != 0xC000)
+                {
+                    if (m_arch == ARCH_V8M_BASE && (next & 0xD000) == 0x9000)
+                        m_rd = 0; // B.W - no link
+                    else
+                        v_decoded = 0;
+                }
             }
             break;
 
@@ -1370,6 +2116,24 @@ int Armv6m::armv6m_decode(uint16_t inst)
                 // Do nothing
             }
             break;
+            // SDIV - SDIV <Rd>,<Rn>,<Rm> (ARMv8-M Baseline)
+            // 1 1 1 1 1 0 1 1 1 0 0 1 Rn (1) (1) (1) (1) Rd 1 1 1 1 Rm
+            case INST_SDIV_OPCODE:
+            // UDIV - UDIV <Rd>,<Rn>,<Rm> (ARMv8-M Baseline)
+            // 1 1 1 1 1 0 1 1 1 0 1 1 Rn (1) (1) (1) (1) Rd 1 1 1 1 Rm
+            case INST_UDIV_OPCODE:
+            {
+                if (m_arch == ARCH_V8M_BASE)
+                {
+                    m_rn = (inst >> 0) & 0xF;
+
+                    // 32-bit instruction
+                    res = 1;
+                }
+                else
+                    v_decoded = 0;
+            }
+            break;
             default:
                 v_decoded = 0;
             break;
@@ -1409,7 +2173,6 @@ int Armv6m::armv6m_decode(uint16_t inst)
             case INST_WFI_OPCODE:
             {
                 // Do nothing
-                assert(0);
             }
             break;
             // YIELD - YIELD
@@ -1417,7 +2180,6 @@ int Armv6m::armv6m_decode(uint16_t inst)
             case INST_YIELD_OPCODE:
             {
                 // Do nothing
-                assert(0);
             }
             break;
             default:
@@ -1426,11 +2188,63 @@ int Armv6m::armv6m_decode(uint16_t inst)
         }
     }
 
-    if (!v_decoded)
+    // Group 9? (ARMv8-M Baseline)
+    if (!v_decoded && m_arch == ARCH_V8M_BASE)
     {
-        assert(!"Instruction decode failed");
+        v_decoded = 1;
+        m_inst_group = INST_IGRP9;
+        switch(inst & INST_IGRP9_MASK)
+        {
+            // CBZ - CBZ <Rn>,<label>
+            // 1 0 1 1 0 0 i 1 imm5 Rn
+            case INST_CBZ_OPCODE:
+            // CBNZ - CBNZ <Rn>,<label>
+            // 1 0 1 1 1 0 i 1 imm5 Rn
+            case INST_CBNZ_OPCODE:
+            {
+                m_rn = (inst >> 0) & 0x7;
+                m_imm= (inst >> 3) & 0x1F;
+                m_imm|= ((inst >> 9) & 0x1) << 5;
+            }
+            break;
+            default:
+                v_decoded = 0;
+            break;
+        }
     }
 
+    // Group 10? (ARMv8-M Baseline)
+    if (!v_decoded && m_arch == ARCH_V8M_BASE)
+    {
+        v_decoded = 1;
+        m_inst_group = INST_IGRP10;
+        switch(inst & INST_IGRP10_MASK)
+        {
+            // MOVW - MOVW <Rd>,#<imm16>
+            // 1 1 1 1 0 i 1 0 0 1 0 0 imm4 0 imm3 Rd imm8
+            case INST_MOVW_OPCODE:
+            // MOVT - MOVT <Rd>,#<imm16>
+            // 1 1 1 1 0 i 1 0 1 1 0 0 imm4 0 imm3 Rd imm8
+            case INST_MOVT_OPCODE:
+            {
+                // imm16 = imm4:i:imm3:imm8 (imm3/imm8 in second word)
+                m_imm = ((inst >> 0) & 0xF) << 12;
+                m_imm|= ((inst >> 10) & 0x1) << 11;
+
+                // 32-bit instruction
+                res = 1;
+            }
+            break;
+            default:
+                v_decoded = 0;
+            break;
+        }
+    }
+
+    // Undefined instruction - HardFault on execute
+    if (!v_decoded)
+        m_inst_group = INST_UNDEFINED;
+
     return res;
 }
 //-------------------------------------------------------------------
@@ -1441,9 +2255,11 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
     uint32_t reg_rm = m_regfile[m_rm];
     uint32_t reg_rn = m_regfile[m_rn];
     uint32_t reg_rd = 0;
+    uint32_t reg_rt = 0;
     uint32_t pc = m_regfile[REG_PC];
     uint32_t offset = 0;
     int write_rd = 0;
+    int write_rt = 0;
 
     // Increment PC to next location
     pc += 2;
@@ -1526,12 +2342,6 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
                         if ((m_apsr & APSR_Z) || (((m_apsr & APSR_N) >> APSR_N_SHIFT) != ((m_apsr & APSR_V) >> APSR_V_SHIFT)))
                             pc = offset;
                         break;
-                    case 14: // AL
-                        pc = offset;
-                        break;
-                    case 15: // SVC
-                        pc = armv6m_exception(pc, 11);
-                        break;
                     default:
                         assert(!"Bad condition code");
                         break;
@@ -1599,24 +2409,45 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // BL - BL <label>
             // 1 1 1 01 S imm10 1 1 J1 1 J2 imm11
             case INST_BL_OPCODE:
+            // B.W - B.W <label> (ARMv8-M Baseline)
+            // 1 1 1 1 0 S imm10 1 0 J1 1 J2 imm11
+            //case INST_B_W_OPCODE:
             {
-                // Sign extend
-                offset = armv6m_sign_extend(m_imm, 11);
-                offset <<= 11;
+                // B.W: I1 = NOT(J1 EOR S), I2 = NOT(J2 EOR S)
+                if (!(inst2 & (1 << 14)))
+                {
+                    uint32_t s  = (inst >> 10) & 0x1;
+                    uint32_t i1 = (((inst2 >> 13) & 0x1) ^ s) ^ 1;
+                    uint32_t i2 = (((inst2 >> 11) & 0x1) ^ s) ^ 1;
+
+                    offset = (s << 24) | (i1 << 23) | (i2 << 22);
+                    offset|= (inst & 0x3FF) << 12;
+                    offset|= (inst2 & 0x7FF) << 1;
+                    offset = armv6m_sign_extend(offset, 25);
 
-                // Additional range
-                m_imm = (inst2 >> 0) & 0x7FF;
-                offset |= m_imm;
+                    // Make relative to PC + 4
+                    pc = offset + pc + 2;
+                }
+                else
+                {
+                    // Sign extend
+                    offset = armv6m_sign_extend(m_imm, 11);
+                    offset <<= 11;
 
-                // Make relative to PC
-                offset <<= 1;
-                offset += pc;
+                    // Additional range
+                    m_imm = (inst2 >> 0) & 0x7FF;
+                    offset |= m_imm;
 
-                // m_rd = REG_LR
-                reg_rd = (pc + 2) | 1;
-                write_rd = 1;
+                    // Make relative to PC
+                    offset <<= 1;
+                    offset += pc;
 
-                pc = offset + 2;
+                    // m_rd = REG_LR
+                    reg_rd = (pc + 2) | 1;
+                    write_rd = 1;
+
+                    pc = offset + 2;
+                }
             }
             break;
             // CMP - CMP <Rn>,#<imm8>
@@ -1636,22 +2467,37 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             {
                 int i;
 
+                uint32_t regs[REGISTERS];
+                uint32_t list = m_reglist;
+
                 for (i=0;i<REGISTERS && m_reglist != 0;i++)
                 {
                     if (m_reglist & (1 << i))
                     {
-                        m_regfile[i] = read32(reg_rn);
-                        if (i == REG_PC)
-                        {
-                            if ((m_regfile[i] & EXC_RETURN) != EXC_RETURN)
-                                m_regfile[i] &= ~1;
-                            pc = m_regfile[i];
-                        }
+                        regs[i] = load<uint32_t>(reg_rn);
                         reg_rn += 4;
                         m_reglist &= ~(1 << i);
                     }               
                 }
 
+                // Not committed if any load faulted
+                if (m_fault_pending)
+                    break;
+
+                for (i=0;i<REGISTERS;i++)
+                {
+                    if (!(list & (1 << i)))
+                        continue;
+
+                    m_regfile[i] = regs[i];
+                    if (i == REG_PC)
+                    {
+                        if ((m_regfile[i] & EXC_RETURN) != EXC_RETURN)
+                            m_regfile[i] &= ~1;
+                        pc = m_regfile[i];
+                    }
+                }
+
                 m_regfile[m_rd] = reg_rn;
                 assert(m_rd != REG_PC);
             }
@@ -1660,7 +2506,8 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 1 0 1 imm5 Rn Rt
             case INST_LDR_OPCODE:
             {
-                m_regfile[m_rt] = read32(reg_rn + (m_imm << 2));
+                reg_rt = load<uint32_t>(reg_rn + (m_imm << 2));
+                write_rt = 1;
                 assert(m_rd != REG_PC);
             }
             break;
@@ -1668,7 +2515,8 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 1 0 0 1 1 Rt imm8
             case INST_LDR_1_OPCODE:
             {
-                m_regfile[m_rt] = read32(reg_rn + (m_imm << 2));
+                reg_rt = load<uint32_t>(reg_rn + (m_imm << 2));
+                write_rt = 1;
                 assert(m_rd != REG_PC);
             }
             break;
@@ -1676,7 +2524,8 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 0 0 1 Rt imm8
             case INST_LDR_2_OPCODE:
             {
-                m_regfile[m_rt] = read32((m_regfile[REG_PC] & 0xFFFFFFFC) + (m_imm << 2) + 4);
+                reg_rt = load<uint32_t>((m_regfile[REG_PC] & 0xFFFFFFFC) + (m_imm << 2) + 4);
+                write_rt = 1;
                 assert(m_rd != REG_PC);
             }
             break;
@@ -1684,14 +2533,16 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 1 1 1 imm5 Rn Rt
             case INST_LDRB_OPCODE:
             {
-                m_regfile[m_rt] = read_mem(reg_rn + m_imm, 1);
+                reg_rt = load<uint8_t>(reg_rn + m_imm);
+                write_rt = 1;
             }
             break;
             // LDRH - LDRH <Rt>,[<Rn>{,#<imm5>}]
             // 1 0 0 0 1 imm5 Rn Rt
             case INST_LDRH_OPCODE:
             {
-                m_regfile[m_rt] = read_mem(reg_rn + (m_imm << 1), 2);
+                reg_rt = load<uint16_t>(reg_rn + (m_imm << 1));
+                write_rt = 1;
             }
             break;
             // LSLS - LSLS <Rd>,<Rm>,#<imm5>
@@ -1750,7 +2601,7 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
                 {
                     if (m_reglist & (1 << i))
                     {
-                        write32(addr, m_regfile[i]);
+                        store<uint32_t>(addr, m_regfile[i]);
                         addr+=4;
                         m_reglist &= ~(1 << i);
                     }               
@@ -1764,28 +2615,28 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 1 0 0 imm5 Rn Rt
             case INST_STR_OPCODE:
             {
-                write32(reg_rn + (m_imm << 2), m_regfile[m_rt]);
+                store<uint32_t>(reg_rn + (m_imm << 2), m_regfile[m_rt]);
             }
             break;
             // STR - STR <Rt>,[SP,#<imm8>]
             // 1 0 0 1 0 Rt imm8
             case INST_STR_1_OPCODE:
             {
-                write32(reg_rn + (m_imm << 2), m_regfile[m_rt]);
+                store<uint32_t>(reg_rn + (m_imm << 2), m_regfile[m_rt]);
             }
             break;
             // STRB - STRB <Rt>,[<Rn>,#<imm5>]
             // 0 1 1 1 0 imm5 Rn Rt
             case INST_STRB_OPCODE:
             {
-                write_mem(reg_rn + m_imm, m_regfile[m_rt], 1);
+                store<uint8_t>(reg_rn + m_imm, m_regfile[m_rt]);
             }
             break;
             // STRH - STRH <Rt>,[<Rn>{,#<imm5>}]
             // 1 0 0 0 0 imm5 Rn Rt
             case INST_STRH_OPCODE:
             {
-                write_mem(reg_rn + (m_imm << 1), m_regfile[m_rt], 2);
+                store<uint16_t>(reg_rn + (m_imm << 1), m_regfile[m_rt]);
             }
             break;
             // SUBS - SUBS <Rdn>,#<imm8>
@@ -1823,7 +2674,8 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 0 1 1 0 0 Rm Rn Rt
             case INST_LDR_3_OPCODE:
             {
-                m_regfile[m_rt] = read32(reg_rn + reg_rm);
+                reg_rt = load<uint32_t>(reg_rn + reg_rm);
+                write_rt = 1;
                 assert(m_rt != REG_PC);
             }
             break;
@@ -1831,30 +2683,32 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 0 1 0 1 1 1 0 Rm Rn Rt
             case INST_LDRB_1_OPCODE:
             {
-                m_regfile[m_rt] = read_mem(reg_rn + reg_rm, 1);
+                reg_rt = load<uint8_t>(reg_rn + reg_rm);
+                write_rt = 1;
             }
             break;
             // LDRH - LDRH <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 1 0 1 Rm Rn Rt
             case INST_LDRH_1_OPCODE:
             {
-                m_regfile[m_rt] = read_mem(reg_rn + reg_rm, 2);
+                reg_rt = load<uint16_t>(reg_rn + reg_rm);
+                write_rt = 1;
             }
             break;
             // LDRSB - LDRSB <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 0 1 1 Rm Rn Rt
             case INST_LDRSB_OPCODE:
             {
-                reg_rd = read_mem(reg_rn + reg_rm, 1);
-                m_regfile[m_rt] = armv6m_sign_extend(reg_rd, 8);
+                reg_rt = load<int8_t>(reg_rn + reg_rm);
+                write_rt = 1;
             }
             break;
             // LDRSH - LDRSH <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 1 1 1 Rm Rn Rt
             case INST_LDRSH_OPCODE:
             {
-                reg_rd = read_mem(reg_rn + reg_rm, 2);
-                m_regfile[m_rt] = armv6m_sign_extend(reg_rd, 16);
+                reg_rt = load<int16_t>(reg_rn + reg_rm);
+                write_rt = 1;
             }
             break;
             // POP - POP <registers>
@@ -1863,27 +2717,39 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             {
                 int i;
                 uint32_t sp = m_regfile[REG_SP];
+                uint32_t regs[REGISTERS];
+                uint32_t list = m_reglist;
                 
                 for (i=0;i<REGISTERS && m_reglist != 0;i++)
                 {
                     if (m_reglist & (1 << i))
                     {                       
-                        m_regfile[i] = read32(sp);
-                        DPRINTF(LOG_PUSHPOP, ("STACK: POP R%d (%x) from %x\n",i,m_regfile[i], sp));
+                        regs[i] = load<uint32_t>(sp);
+                        DPRINTF(LOG_PUSHPOP, ("STACK: POP R%d (%x) from %x\n",i,regs[i], sp));
 
                         sp+=4;
-
-                        if (i == REG_PC)
-                        {
-                            if ((m_regfile[i] & EXC_RETURN) != EXC_RETURN)
-                                m_regfile[i] &= ~1;
-                            pc = m_regfile[i];
-                        }
-                        
                         m_reglist &= ~(1 << i);
                     }               
                 }
 
+                // Not committed if any load faulted
+                if (m_fault_pending)
+                    break;
+
+                for (i=0;i<REGISTERS;i++)
+                {
+                    if (!(list & (1 << i)))
+                        continue;
+
+                    m_regfile[i] = regs[i];
+                    if (i == REG_PC)
+                    {
+                        if ((m_regfile[i] & EXC_RETURN) != EXC_RETURN)
+                            m_regfile[i] &= ~1;
+                        pc = m_regfile[i];
+                    }
+                }
+
                 armv6m_update_sp(sp);
             }
             break;
@@ -1907,35 +2773,36 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
                     if (m_reglist & (1 << i))
                     {
                         DPRINTF(LOG_PUSHPOP, ("STACK: PUSH R%d (%x) to %x\n",i,m_regfile[i], addr));
-                        write32(addr, m_regfile[i]);
+                        store<uint32_t>(addr, m_regfile[i]);
                         sp-=4;
                         addr+=4;
                         m_reglist &= ~(1 << i);
                     }               
                 }
 
-                armv6m_update_sp(sp);
+                if (!m_fault_pending)
+                    armv6m_update_sp(sp);
             }
             break;
             // STR - STR <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 0 00 Rm Rn Rt
             case INST_STR_2_OPCODE:
             {
-                write32(reg_rn + reg_rm, m_regfile[m_rt]);
+                store<uint32_t>(reg_rn + reg_rm, m_regfile[m_rt]);
             }
             break;
             // STRB - STRB <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 0 1 0 Rm Rn Rt
             case INST_STRB_1_OPCODE:
             {
-                write_mem(reg_rn + reg_rm, m_regfile[m_rt], 1);
+                store<uint8_t>(reg_rn + reg_rm, m_regfile[m_rt]);
             }
             break;
             // STRH - STRH <Rt>,[<Rn>,<Rm>]
             // 0 1 0 1 0 0 1 Rm Rn Rt
             case INST_STRH_1_OPCODE:
             {
-                write_mem(reg_rn + reg_rm, m_regfile[m_rt], 2);
+                store<uint16_t>(reg_rn + reg_rm, m_regfile[m_rt]);
             }
             break;
             // SUBS - SUBS <Rd>,<Rn>,#<imm3>
@@ -1974,8 +2841,11 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             case INST_BKPT_OPCODE:
             {
                 // Instruction used for program exit
-                printf("Exit code = %d\n", m_imm);
-                exit(m_imm);
+                m_stop_reason = STOP_EXIT;
+                m_exit_code   = m_imm;
+
+                // Halt on the BKPT
+                pc = m_regfile[REG_PC];
             }
             break;
             // CMP - CMP <Rn>,<Rm> <Rn> and <Rm> not both from R0-R7
@@ -2016,7 +2886,7 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 1 1 0 1 1 1 1 0 imm8
             case INST_UDF_OPCODE:
             {
-                assert(!"Not implemented");
+                m_fault_pending = true;
             }
             break;
         }
@@ -2407,6 +3277,7 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
                         if (m_current_mode == MODE_THREAD)
                         {
                             m_control = reg_rn & CONTROL_MASK;
+                            armv6m_mpu_update();
 
                             // Allow switching of current SP
                             //if (m_control & CONTROL_SPSEL)
@@ -2460,8 +3331,56 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 1 11 1 0 1 1 1 1 1 1 1 imm4 1 0 1 0 imm12
             case INST_UDF_W_OPCODE:
             {
+                m_fault_pending = true;
+            }
+            break;
+            // SDIV - SDIV <Rd>,<Rn>,<Rm>
+            // 1 1 1 1 1 0 1 1 1 0 0 1 Rn (1) (1) (1) (1) Rd 1 1 1 1 Rm
+            case INST_SDIV_OPCODE:
+            {
+                m_rd = (inst2 >> 8) & 0xF;
+                m_rm = (inst2 >> 0) & 0xF;
+                reg_rm = m_regfile[m_rm];
+
+                if (REG_SP_OR_PC(m_rd) || REG_SP_OR_PC(m_rn) || REG_SP_OR_PC(m_rm))
+                {
+                    m_fault_pending = true;
+                    break;
+                }
+
+                // Increment PC past second instruction word
+                pc += 2;
+
+                // Divide by zero returns 0 (CCR.DIV_0_TRP not modelled)
+                if (reg_rm == 0)
+                    reg_rd = 0;
+                else if (reg_rn == 0x80000000 && reg_rm == 0xFFFFFFFF)
+                    reg_rd = 0x80000000;
+                else
+                    reg_rd = (uint32_t)((int32_t)reg_rn / (int32_t)reg_rm);
+                write_rd = 1;
+            }
+            break;
+            // UDIV - UDIV <Rd>,<Rn>,<Rm>
+            // 1 1 1 1 1 0 1 1 1 0 1 1 Rn (1) (1) (1) (1) Rd 1 1 1 1 Rm
+            case INST_UDIV_OPCODE:
+            {
+                m_rd = (inst2 >> 8) & 0xF;
+                m_rm = (inst2 >> 0) & 0xF;
+                reg_rm = m_regfile[m_rm];
+
+                if (REG_SP_OR_PC(m_rd) || REG_SP_OR_PC(m_rn) || REG_SP_OR_PC(m_rm))
+                {
+                    m_fault_pending = true;
+                    break;
+                }
+
                 // Increment PC past second instruction word
                 pc += 2;
+
+                // Divide by zero returns 0 (CCR.DIV_0_TRP not modelled)
+                reg_rd = reg_rm ? (reg_rn / reg_rm) : 0;
+                write_rd = 1;
             }
             break;
         }
@@ -2496,20 +3415,99 @@ void Armv6m::armv6m_execute(uint16_t inst, uint16_t inst2)
             // 1 0 1 1 1 1 1 1 0 0 1 1 0 0 0 0
             case INST_WFI_OPCODE:
             {
-                assert(!"Not implemented");
+                // Treated as a NOP (pending interrupts are taken
+                // at the end of each step)
             }
             break;
             // YIELD - YIELD
             // 1 0 1 1 1 1 1 1 0 0 0 1 0 0 0 0
             case INST_YIELD_OPCODE:
             {
-                assert(!"Not implemented");
+                // Hint only - NOP on a single core
+            }
+            break;
+        }
+    }
+    break;
+    case INST_IGRP9:
+    {
+        switch(inst & INST_IGRP9_MASK)
+        {
+            // CBZ - CBZ <Rn>,<label>
+            // 1 0 1 1 0 0 i 1 imm5 Rn
+            case INST_CBZ_OPCODE:
+            {
+                // Relative to PC + 4 (forwards only)
+                if (reg_rn == 0)
+                    pc = pc + 2 + (m_imm << 1);
+            }
+            break;
+            // CBNZ - CBNZ <Rn>,<label>
+            // 1 0 1 1 1 0 i 1 imm5 Rn
+            case INST_CBNZ_OPCODE:
+            {
+                // Relative to PC + 4 (forwards only)
+                if (reg_rn != 0)
+                    pc = pc + 2 + (m_imm << 1);
+            }
+            break;
+        }
+    }
+    break;
+    case INST_IGRP10:
+    {
+        uint32_t imm16 = m_imm;
+
+        // imm3:imm8 from second instruction word
+        imm16|= ((inst2 >> 12) & 0x7) << 8;
+        imm16|= ((inst2 >> 0) & 0xFF);
+        m_rd = (inst2 >> 8) & 0xF;
+
+        if (REG_SP_OR_PC(m_rd))
+        {
+            m_fault_pending = true;
+            break;
+        }
+
+        // Increment PC past second instruction word
+        pc += 2;
+
+        switch(inst & INST_IGRP10_MASK)
+        {
+            // MOVW - MOVW <Rd>,#<imm16>
+            // 1 1 1 1 0 i 1 0 0 1 0 0 imm4 0 imm3 Rd imm8
+            case INST_MOVW_OPCODE:
+            {
+                reg_rd = imm16;
+                write_rd = 1;
+            }
+            break;
+            // MOVT - MOVT <Rd>,#<imm16>
+            // 1 1 1 1 0 i 1 0 1 1 0 0 imm4 0 imm3 Rd imm8
+            case INST_MOVT_OPCODE:
+            {
+                reg_rd = (m_regfile[m_rd] & 0xFFFF) | (imm16 << 16);
+                write_rd = 1;
             }
             break;
         }
     }
     break;
+    // Undefined instruction
+    case INST_UNDEFINED:
+    {
+        m_fault_pending = true;
     }
+    break;
+    }
+
+    // Faulting instruction: no register writeback (the HardFault
+    // stacks the state from before it)
+    if (m_fault_pending)
+        write_rd = write_rt = 0;
+
+    if (write_rt)
+        m_regfile[m_rt] = reg_rt;
 
     if (write_rd)
     {
@@ -1,12 +1,15 @@
 #ifndef __ARMV6M_H__
 #define __ARMV6M_H__
 
+#include <stdio.h>
 #include <stdint.h>
 #include <vector>
+#include <map>
 #include "armv6m_opcodes.h"
 #include "memory.h"
 #include "systick.h"
 #include "sysuart.h"
+#include "mpu.h"
 
 //-------------------------------------------------------------------
 // Defines:
@@ -37,8 +40,23 @@
 
 typedef enum { MODE_THREAD = 0, MODE_HANDLER } tMode;
 
+// ARCH_V8M_BASE adds the ARMv8-M Baseline (Cortex-M23) extensions
+typedef enum { ARCH_V6M = 0, ARCH_V8M_BASE } tArch;
+
 #define EXC_RETURN          0xFFFFFFE0
 
+#define EXC_HARDFAULT       3
+
+//--------------------------------------------------------------------
+// Stop reasons:
+//--------------------------------------------------------------------
+typedef enum
+{
+    STOP_NONE = 0,  // Running
+    STOP_EXIT,      // BKPT - program exit (see get_exit_code)
+    STOP_FAULT      // Unrecoverable fault (lockup or fatal error)
+} tStopReason;
+
 //--------------------------------------------------------------------
 // Defines:
 //--------------------------------------------------------------------
@@ -49,21 +67,203 @@ typedef enum { MODE_THREAD = 0, MODE_HANDLER } tMode;
 #define LOG_INST        (1 << 4)
 #define LOG_FLAGS       (1 << 5)
 
-#define MAX_MEM_REGIONS     16
+//--------------------------------------------------------------------
+// Memory regions: sorted by base address, never overlapping
+//--------------------------------------------------------------------
+struct tMemRegion
+{
+    uint32_t            base;
+    uint32_t            size;
+    Memory             *mem;
+};
+
+//--------------------------------------------------------------------
+// Page table: two levels of 1024 entries, 4KB pages
+//--------------------------------------------------------------------
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1 << PAGE_SHIFT)
+#define PAGE_MASK           (PAGE_SIZE - 1)
+#define PT_L2_BITS          10
+#define PT_L2_ENTRIES       (1 << PT_L2_BITS)
+#define PT_L1_SHIFT         (PAGE_SHIFT + PT_L2_BITS)
+#define PT_L1_ENTRIES       (1 << (32 - PT_L1_SHIFT))
+
+// Page shared by more than one region (resolved by region scan)
+#define PAGE_MIXED          (1 << 0)
+// Page to be saved to snapshots before it is next written
+#define PAGE_COW            (1 << 1)
+// Page not written since dirty tracking was last cleared
+#define PAGE_CLEAN          (1 << 2)
+// Read-only memory (writes fault)
+#define PAGE_RO             (1 << 3)
+// Page has read / write watchpoints
+#define PAGE_WATCH_R        (1 << 4)
+#define PAGE_WATCH_W        (1 << 5)
+// MPU: no read / write access privileged (P) / unprivileged (U), no
+// execute, or permissions vary within the page (check by address)
+#define PAGE_MPU_P_NR       (1 << 6)
+#define PAGE_MPU_P_NW       (1 << 7)
+#define PAGE_MPU_U_NR       (1 << 8)
+#define PAGE_MPU_U_NW       (1 << 9)
+#define PAGE_MPU_NX         (1 << 10)
+#define PAGE_MPU_PARTIAL    (1 << 11)
+#define PAGE_MPU            (PAGE_MPU_P_NR | PAGE_MPU_P_NW | PAGE_MPU_U_NR | PAGE_MPU_U_NW | PAGE_MPU_NX | PAGE_MPU_PARTIAL)
+
+// Flags which force fetches / loads / stores off the direct host access
+// path (plus the MPU flags for the current privilege, when enabled)
+#define PAGE_SLOW_FETCH     (PAGE_MIXED)
+#define PAGE_SLOW_READ      (PAGE_MIXED | PAGE_WATCH_R)
+#define PAGE_SLOW_WRITE     (PAGE_MIXED | PAGE_COW | PAGE_CLEAN | PAGE_RO | PAGE_WATCH_W)
+
+typedef enum { ACCESS_READ = 0, ACCESS_WRITE, ACCESS_FETCH } tAccess;
+
+struct tPage
+{
+    Memory             *mem;    // Region mapped into this page
+    uint32_t            base;   // Base address of that region
+    uint32_t            size;   // Size of that region
+    uint8_t            *host;   // Region buffer for direct access (or NULL)
+    uint32_t            flags;
+    tMmioReg           *mmio;   // Device registers by word (or NULL)
+};
+
+#define PAGE_MMIO_REGS      (PAGE_SIZE / 4)
+
+//--------------------------------------------------------------------
+// Watchpoints:
+//--------------------------------------------------------------------
+typedef enum { WATCH_WRITE = 1, WATCH_READ = 2, WATCH_ACCESS = 3 } tWatchType;
+
+struct tWatchpoint
+{
+    uint32_t            addr;
+    uint32_t            len;
+    tWatchType          type;
+};
+
+struct tWatchHit
+{
+    uint32_t            pc;     // Instruction making the access
+    uint32_t            addr;
+    uint32_t            value;  // Value read / written
+    tWatchType          type;   // WATCH_READ or WATCH_WRITE
+};
+
+//--------------------------------------------------------------------
+// Heatmap: guest accesses per page (indexed by address >> PAGE_SHIFT)
+//--------------------------------------------------------------------
+#define HEAT_PAGES          (1 << (32 - PAGE_SHIFT))
+
+struct tHeat
+{
+    uint64_t            reads;
+    uint64_t            writes;
+    uint64_t            fetches;
+};
 
 typedef void (*FP_SIM_STEP)(void *p);
 
+//--------------------------------------------------------------------
+// Memoisation of pure functions:
+//--------------------------------------------------------------------
+#define MEMO_MAX_RESULTS    4096    // Cached argument sets per function
+#define MEMO_MAX_SPANS      16      // Distinct address ranges read
+#define MEMO_SPAN_GAP       256     // Merge reads closer than this
+
+// PUSH stores below SP before SP is written back
+#define MEMO_PUSH_WINDOW    (REGISTERS * 4)
+
+struct tMemoKey
+{
+    uint32_t args[4];   // R0-R3
+
+    bool operator<(const tMemoKey &o) const
+    {
+        for (int i=0;i<4;i++)
+            if (args[i] != o.args[i])
+                return args[i] < o.args[i];
+        return false;
+    }
+};
+
+struct tMemoResult
+{
+    uint32_t regs[5];   // R0-R3, R12 at return
+    uint32_t apsr;
+    uint32_t insts;     // Instructions executed by the call
+};
+
+struct tMemoSpan
+{
+    uint32_t lo;
+    uint32_t hi;
+};
+
+struct tMemoFunc
+{
+    uint32_t                            addr;
+    bool                                impure;
+    std::map <tMemoKey, tMemoResult>    results;
+    std::vector <tMemoSpan>             spans; // Reads outside the stack frame
+    uint64_t                            hits;
+};
+
+//--------------------------------------------------------------------
+// Snapshots:
+//--------------------------------------------------------------------
+#define MAX_DEVICE_STATE    32
+
+struct tCpuState
+{
+    uint32_t            regfile[REGISTERS];
+    uint32_t            psp;
+    uint32_t            msp;
+    uint32_t            apsr;
+    uint32_t            ipsr;
+    uint32_t            epsr;
+    uint32_t            primask;
+    uint32_t            control;
+    tMode               current_mode;
+    uint32_t            entry_point;
+    bool                fault;
+    bool                fault_pending;
+    tStopReason         stop_reason;
+    int                 exit_code;
+    bool                systick_irq;
+    uint64_t            inst_count;
+};
+
+struct tSnapshot
+{
+    tCpuState           cpu;
+
+    // Device state (by region base address)
+    std::map <uint32_t, std::vector <uint32_t> > devices;
+
+    // Memory pages as they were when the snapshot was taken, saved
+    // before they are first written (copy-on-write)
+    std::map <uint32_t, uint8_t *> pages;
+};
+
 //--------------------------------------------------------------------
 // Armv6m: Simple ARM v6m model
 //--------------------------------------------------------------------
 class Armv6m
 {
+    // Runs instances in lockstep on their state (armv6m_lanes.h)
+    friend class Armv6mLanes;
+
 public:
                         Armv6m(uint32_t baseAddr = 0, uint32_t len = 0);
     virtual             ~Armv6m();
 
     bool                create_memory(uint32_t addr, uint32_t size, uint8_t *mem = NULL);
     bool                attach_memory(Memory *memory, uint32_t baseAddr, uint32_t len);
+    bool                map_memory(uint32_t addr, uint32_t size, const char *filename, bool shared = false, uint32_t offset = 0);
+    bool                create_shared_memory(uint32_t addr, uint32_t size, const char *name);
+    bool                create_rom(uint32_t addr, uint32_t size, const uint8_t *image, const char *key, bool cow = false);
+    bool                map_rom(uint32_t addr, uint32_t size, const char *filename, uint32_t offset, bool cow = false);
+    bool                attach_mmio(uint32_t addr, FP_MMIO_READ read, FP_MMIO_WRITE write, void *ctx, uint32_t offset = 0);
 
     bool                valid_addr(uint32_t address);
     void                write(uint32_t address, uint8_t data);
@@ -73,6 +273,14 @@ public:
     uint32_t            read32(uint32_t address);
     uint32_t            read_mem(uint32_t address, int width);
 
+    // Block access (debugger / loaders)
+    bool                read_block(uint32_t address, uint8_t *dst, uint32_t len);
+    bool                write_block(uint32_t address, const uint8_t *src, uint32_t len);
+
+    // Typed access: width from the type, signed types sign extend
+    template <typename T> T    load(uint32_t address);
+    template <typename T> void store(uint32_t address, T data);
+
     void                reset(uint32_t start_addr);
     uint32_t            get_opcode(uint32_t pc);
     void                step(void);
@@ -82,7 +290,9 @@ public:
     void                set_interrupt(int irq);
 
     bool                get_fault(void)      { return m_fault; }
-    bool                get_stopped(void)    { return false; }
+    bool                get_stopped(void)    { return m_stop_reason != STOP_NONE; }
+    tStopReason         get_stop_reason(void){ return m_stop_reason; }
+    int                 get_exit_code(void)  { return m_exit_code; }
     bool                get_reg_valid(int r) { return true; }
     uint32_t            get_register(int r);
 
@@ -101,11 +311,45 @@ public:
     bool                clr_breakpoint(uint32_t pc);
     bool                check_breakpoint(uint32_t pc);
 
+    // Watchpoints (hits stop via get_break)
+    bool                set_watchpoint(uint32_t addr, uint32_t len, tWatchType type);
+    bool                clr_watchpoint(uint32_t addr, uint32_t len, tWatchType type);
+    bool                get_watch_hit(tWatchHit *hit);
+
     void                enable_trace(uint32_t mask)                 { m_trace = mask; }
 
+    void                set_arch(tArch arch)    { m_arch = arch; }
+    tArch               get_arch(void)          { return m_arch; }
+
+    uint64_t            get_inst_count(void)    { return m_inst_count; }
+
+    // Snapshots of complete machine state
+    tSnapshot          *snapshot(void);
+    void                restore(tSnapshot *snap);
+    void                snapshot_free(tSnapshot *snap);
+
+    // Dirty page tracking / incremental checkpoints
+    void                set_dirty_tracking(bool enable);
+    int                 get_dirty_pages(std::vector <uint32_t> &pages);
+    void                clr_dirty_pages(void);
+    bool                checkpoint_save(FILE *f, const char *image = "");
+    int                 checkpoint_restore(FILE *f, const char *image = "");
+
+    // Post-mortem ELF core file
+    bool                core_dump(FILE *f);
+
+    // Per-page access counts (NULL when disabled)
+    bool                set_heatmap(bool enable);
+    const tHeat        *get_heatmap(void)       { return m_heat; }
+
+    // Memoisation of pure functions
+    bool                memo_add_function(uint32_t addr);
+    uint64_t            memo_get_hits(void);
+
     bool                error(bool terminal, const char *fmt, ...);
 
 protected:
+    template <typename T> T    armv6m_load(uint32_t address, tAccess access);
     uint16_t            armv6m_read_inst(uint32_t addr);
     void                armv6m_update_sp(uint32_t sp);
     void                armv6m_update_n_z_flags(uint32_t rd);
@@ -115,12 +359,111 @@ protected:
     uint32_t            armv6m_arith_shift_right(uint32_t val, uint32_t shift, uint32_t mask);
     uint32_t            armv6m_rotate_right(uint32_t val, uint32_t shift, uint32_t mask);
     uint32_t            armv6m_sign_extend(uint32_t val, int offset);
-    void                armv6m_dump_inst(uint16_t inst);
+    void                armv6m_dump_inst(uint16_t inst, uint16_t inst2);
     uint32_t            armv6m_exception(uint32_t pc, uint32_t exception);
+    void                armv6m_hardfault(uint32_t pc);
+    uint32_t            armv6m_read_vector(uint32_t exception);
+
+    void                armv6m_memo_check(void);
+    void                armv6m_memo_load(uint32_t addr);
+    void                armv6m_memo_store(uint32_t addr);
+    void                armv6m_memo_span(tMemoFunc *func, uint32_t addr);
+    bool                armv6m_memo_is_mmio(uint32_t addr);
+    void                armv6m_memo_flush(void);
+
+    static void         armv6m_mpu_changed(void *arg, int region);
+    void                armv6m_mpu_update(void);
+    void                armv6m_mpu_pages(uint32_t base, uint64_t end);
+    bool                armv6m_mpu_check(uint32_t address, tAccess access);
+    bool                armv6m_mpu_allowed(uint32_t address, bool priv, tAccess access);
+    int                 armv6m_mpu_covers(int region, uint32_t page_base);
+    bool                armv6m_mpu_extent(int region, uint32_t *base, uint64_t *end);
+
+    void                armv6m_watch_pages(void);
+    void                armv6m_watch_check(uint32_t address, int width, uint32_t value, tWatchType type);
+
+    bool                armv6m_page_write(uint32_t address);
+    void                armv6m_page_modify(uint32_t address);
+    void                armv6m_page_flags(uint32_t flag, bool set);
+    void                armv6m_snapshot_page(uint32_t address);
+    void                armv6m_save_cpu(tCpuState *cpu);
+    void                armv6m_restore_cpu(const tCpuState *cpu);
+    void                armv6m_save_devices(std::map <uint32_t, std::vector <uint32_t> > &devices);
+    void                armv6m_restore_devices(const std::map <uint32_t, std::vector <uint32_t> > &devices);
+    void                armv6m_page_copy(uint32_t page, uint8_t *buf, bool to_mem);
+
+    void                armv6m_map_pages(const tMemRegion &region);
+    int                 armv6m_find_region(uint32_t address);
+    Memory             *armv6m_lookup_mixed(uint32_t address, uint32_t *offset);
+
+    //-----------------------------------------------------------------
+    // armv6m_page: Page table entry for an address (NULL if unmapped)
+    //-----------------------------------------------------------------
+    tPage *armv6m_page(uint32_t address)
+    {
+        tPage *l2 = m_page_table[address >> PT_L1_SHIFT];
+        if (!l2)
+            return NULL;
+
+        return &l2[(address >> PAGE_SHIFT) & (PT_L2_ENTRIES - 1)];
+    }
+
+    //-----------------------------------------------------------------
+    // armv6m_lookup: Find memory for an address (NULL if unmapped)
+    //-----------------------------------------------------------------
+    Memory *armv6m_lookup(uint32_t address, uint32_t *offset)
+    {
+        tPage *page = armv6m_page(address);
+        if (!page)
+            return NULL;
+
+        if (page->flags & PAGE_MIXED)
+            return armv6m_lookup_mixed(address, offset);
+
+        *offset = address - page->base;
+        if (*offset >= page->size)
+            return NULL;
+
+        return page->mem;
+    }
+
+    //-----------------------------------------------------------------
+    // armv6m_mmio: Register bound to a (word) address (NULL if none)
+    //-----------------------------------------------------------------
+    tMmioReg *armv6m_mmio(uint32_t address)
+    {
+        tPage *page = armv6m_page(address);
+        if (!page || !page->mmio)
+            return NULL;
+
+        tMmioReg *reg = &page->mmio[(address & PAGE_MASK) >> 2];
+        if (!reg->ctx)
+            return NULL;
+
+        return reg;
+    }
+
+    //-----------------------------------------------------------------
+    // armv6m_host_addr: Host address for plain memory (NULL otherwise,
+    // or if the page has any of the slow path flags set)
+    //-----------------------------------------------------------------
+    uint8_t *armv6m_host_addr(uint32_t address, uint32_t slow_flags)
+    {
+        tPage *page = armv6m_page(address);
+        if (!page)
+            return NULL;
+
+        uint32_t offset = address - page->base;
+        if (!page->host || offset >= page->size || (page->flags & slow_flags))
+            return NULL;
+
+        return page->host + offset;
+    }
     void                armv6m_exc_return(uint32_t pc);
 
 public:
     int                 armv6m_decode(uint16_t inst);
+    int                 armv6m_decode_cached(uint16_t inst);
     void                armv6m_execute(uint16_t inst, uint16_t inst2);
 
 protected:  
@@ -139,6 +482,8 @@ protected:
 
     uint32_t            m_entry_point;
 
+    tArch               m_arch;
+
     // Decode
     int                 m_inst_group;
     uint32_t            m_rd;
@@ -153,28 +498,69 @@ private:
 
 
     // Memory
-    Memory             *m_mem[MAX_MEM_REGIONS];
-    uint32_t            m_mem_base[MAX_MEM_REGIONS];
-    uint32_t            m_mem_size[MAX_MEM_REGIONS];
-    int                 m_mem_regions;
+    std::vector <tMemRegion> m_regions;
+    tPage              *m_page_table[PT_L1_ENTRIES];
 
     // Status
     bool                m_fault;
+    bool                m_fault_pending;
     bool                m_break;
+    tStopReason         m_stop_reason;
+    int                 m_exit_code;
     int                 m_trace;
+    uint32_t            m_trace_apsr;
 
     // Breakpoints
     bool                m_has_breakpoints;
     std::vector <uint32_t > m_breakpoints;
 
+    // Watchpoints
+    std::vector <tWatchpoint> m_watchpoints;
+    bool                m_watch_hit_valid;
+    tWatchHit           m_watch_hit;
+
     // Systick
     Systick            *m_systick;
+    bool                m_systick_irq;
 
     // UART
     Sysuart            *m_uart;
 
+    // MPU (with the per-page flags valid for each region's extent)
+    Mpu                *m_mpu;
+    bool                m_mpu_active;
+    uint32_t            m_mpu_base[MPU_REGIONS];
+    uint64_t            m_mpu_end[MPU_REGIONS];
+
+    // Page flags forcing the slow path (current privilege)
+    uint32_t            m_slow_fetch;
+    uint32_t            m_slow_read;
+    uint32_t            m_slow_write;
+
     FP_SIM_STEP         m_step_cb;
     void               *m_step_cb_arg;
+
+    uint64_t            m_inst_count;
+
+    // Memoisation
+    std::vector <tMemoFunc> m_memo_funcs;
+    bool                m_memo_profiling;
+    tMemoFunc          *m_memo_func;
+    tMemoKey            m_memo_key;
+    uint32_t            m_memo_entry_sp;
+    uint32_t            m_memo_ret_pc;
+    uint64_t            m_memo_start;
+    bool                m_memo_pure;
+    std::vector <tMemoSpan> m_memo_reads;
+
+    // Snapshots
+    std::vector <tSnapshot *> m_snapshots;
+
+    // Dirty page tracking
+    bool                m_dirty_tracking;
+
+    // Access heatmap
+    tHeat              *m_heat;
 };
 
 #endif
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Dirty page tracking and incremental checkpoints
+//
+// Whilst tracking, every page starts out PAGE_CLEAN. The first store
+// to a clean page takes the slow path, which clears the flag, so pages
+// without it are the ones written since tracking was last cleared.
+//
+// A checkpoint file is a series of records, each holding the CPU
+// state, device state and the pages written since the previous record.
+// Replaying every record over the freshly loaded image (same program,
+// same memory map) reproduces the state at the last checkpoint.
+//
+// Records are 32-bit words, with the CPU state written
+// field by field (not as the in-memory structure). Each record header
+// holds the format version and the key of the image the run was
+// started from, and records for any other version / image are refused.
+//-----------------------------------------------------------------
+#define CHECKPOINT_MAGIC        0x54504B43 // "CKPT"
+#define CHECKPOINT_END          0x444E4521 // "!END"
+#define CHECKPOINT_VERSION      2
+#define CHECKPOINT_MAX_KEY      1024
+#define CHECKPOINT_CPU_WORDS    (REGISTERS + 16)
+
+//-----------------------------------------------------------------
+// checkpoint_cpu_pack: CPU state to checkpoint words
+//-----------------------------------------------------------------
+static void checkpoint_cpu_pack(const tCpuState *cpu, uint32_t *w)
+{
+    for (int i=0;i<REGISTERS;i++)
+        *w++ = cpu->regfile[i];
+
+    *w++ = cpu->psp;
+    *w++ = cpu->msp;
+    *w++ = cpu->apsr;
+    *w++ = cpu->ipsr;
+    *w++ = cpu->epsr;
+    *w++ = cpu->primask;
+    *w++ = cpu->control;
+    *w++ = (uint32_t)cpu->current_mode;
+    *w++ = cpu->entry_point;
+    *w++ = cpu->fault;
+    *w++ = cpu->fault_pending;
+    *w++ = (uint32_t)cpu->stop_reason;
+    *w++ = (uint32_t)cpu->exit_code;
+    *w++ = cpu->systick_irq;
+    *w++ = (uint32_t)cpu->inst_count;
+    *w++ = (uint32_t)(cpu->inst_count >> 32);
+}
+//-----------------------------------------------------------------
+// checkpoint_cpu_unpack: Checkpoint words to CPU state
+//-----------------------------------------------------------------
+static void checkpoint_cpu_unpack(const uint32_t *w, tCpuState *cpu)
+{
+    for (int i=0;i<REGISTERS;i++)
+        cpu->regfile[i] = *w++;
+
+    cpu->psp           = *w++;
+    cpu->msp           = *w++;
+    cpu->apsr          = *w++;
+    cpu->ipsr          = *w++;
+    cpu->epsr          = *w++;
+    cpu->primask       = *w++;
+    cpu->control       = *w++;
+    cpu->current_mode  = (tMode)*w++;
+    cpu->entry_point   = *w++;
+    cpu->fault         = *w++ != 0;
+    cpu->fault_pending = *w++ != 0;
+    cpu->stop_reason   = (tStopReason)*w++;
+    cpu->exit_code     = (int)*w++;
+    cpu->systick_irq   = *w++ != 0;
+    cpu->inst_count    = w[0] | ((uint64_t)w[1] << 32);
+}
+
+//-----------------------------------------------------------------
+// set_dirty_tracking: Enable (all pages clean) / disable tracking
+//-----------------------------------------------------------------
+void Armv6m::set_dirty_tracking(bool enable)
+{
+    m_dirty_tracking = enable;
+    armv6m_page_flags(PAGE_CLEAN, enable);
+}
+//-----------------------------------------------------------------
+// get_dirty_pages: Addresses of pages written since last cleared
+//-----------------------------------------------------------------
+int Armv6m::get_dirty_pages(std::vector <uint32_t> &pages)
+{
+    pages.clear();
+
+    if (!m_dirty_tracking)
+        return 0;
+
+    for (uint32_t i=0;i<PT_L1_ENTRIES;i++)
+    {
+        tPage *l2 = m_page_table[i];
+        if (!l2)
+            continue;
+
+        for (uint32_t j=0;j<PT_L2_ENTRIES;j++)
+            if ((l2[j].host || (l2[j].flags & PAGE_MIXED)) && !(l2[j].flags & PAGE_CLEAN))
+                pages.push_back((i << PT_L1_SHIFT) | (j << PAGE_SHIFT));
+    }
+
+    return pages.size();
+}
+//-----------------------------------------------------------------
+// clr_dirty_pages: Mark all pages clean
+//-----------------------------------------------------------------
+void Armv6m::clr_dirty_pages(void)
+{
+    if (m_dirty_tracking)
+        armv6m_page_flags(PAGE_CLEAN, true);
+}
+//-----------------------------------------------------------------
+// checkpoint_save: Append a checkpoint record of the state and the
+// pages written since the last one. Enables dirty tracking - the first
+// record holds pages written since tracking was enabled.
+// image: key identifying the loaded image (e.g. path:inode:mtime).
+//-----------------------------------------------------------------
+bool Armv6m::checkpoint_save(FILE *f, const char *image /*=""*/)
+{
+    std::vector <uint32_t> pages;
+    std::map <uint32_t, std::vector <uint32_t> > devices;
+    tCpuState cpu;
+    uint32_t  words[CHECKPOINT_CPU_WORDS];
+    uint32_t  word;
+    uint32_t  key_len = strlen(image);
+    bool      ok = true;
+
+    if (key_len > CHECKPOINT_MAX_KEY)
+        return false;
+
+    if (!m_dirty_tracking)
+        set_dirty_tracking(true);
+
+    armv6m_save_cpu(&cpu);
+    armv6m_save_devices(devices);
+    get_dirty_pages(pages);
+
+    word = CHECKPOINT_MAGIC;
+    ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+    word = CHECKPOINT_VERSION;
+    ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+    ok &= fwrite(&key_len, sizeof(key_len), 1, f) == 1;
+    ok &= fwrite(image, 1, key_len, f) == key_len;
+
+    checkpoint_cpu_pack(&cpu, words);
+    ok &= fwrite(words, sizeof(uint32_t), CHECKPOINT_CPU_WORDS, f) == CHECKPOINT_CPU_WORDS;
+
+    // Devices: base address, length, state words
+    word = devices.size();
+    ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+    for (std::map<uint32_t, std::vector <uint32_t> >::iterator it = devices.begin(); it != devices.end(); ++it)
+    {
+        word = it->second.size();
+        ok &= fwrite(&it->first, sizeof(uint32_t), 1, f) == 1;
+        ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+        ok &= fwrite(&it->second[0], sizeof(uint32_t), word, f) == word;
+    }
+
+    word = pages.size();
+    ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+    for (uint32_t i=0;i<pages.size();i++)
+    {
+        uint8_t buf[PAGE_SIZE];
+
+        armv6m_page_copy(pages[i], buf, false);
+        ok &= fwrite(&pages[i], sizeof(uint32_t), 1, f) == 1;
+        ok &= fwrite(buf, 1, PAGE_SIZE, f) == PAGE_SIZE;
+    }
+
+    word = CHECKPOINT_END;
+    ok &= fwrite(&word, sizeof(word), 1, f) == 1;
+    ok &= fflush(f) == 0;
+
+    clr_dirty_pages();
+    return ok;
+}
+//-----------------------------------------------------------------
+// checkpoint_restore: Replay checkpoint records. A truncated final
+// record (e.g. the host died whilst writing it) is ignored.
+// Returns the number of records applied, or -1 on a corrupt file or
+// one written by another version or from another image.
+// The file is left positioned after the last complete record.
+//-----------------------------------------------------------------
+int Armv6m::checkpoint_restore(FILE *f, const char *image /*=""*/)
+{
+    uint32_t key_len = strlen(image);
+
+    int records = 0;
+
+    for (;;)
+    {
+        long pos = ftell(f);
+        std::map <uint32_t, std::vector <uint32_t> > devices;
+        std::vector <uint32_t> addrs;
+        std::vector <uint8_t>  data;
+        tCpuState cpu;
+        uint32_t  words[CHECKPOINT_CPU_WORDS];
+        char      key[CHECKPOINT_MAX_KEY];
+        uint32_t  word;
+        bool      ok = true;
+
+        if (fread(&word, sizeof(word), 1, f) != 1)
+            break;
+        if (word != CHECKPOINT_MAGIC)
+            return -1;
+
+        ok &= fread(&word, sizeof(word), 1, f) == 1;
+        if (ok && word != CHECKPOINT_VERSION)
+        {
+            fprintf(stderr, "Checkpoint: Version %u not supported\n", word);
+            return -1;
+        }
+
+        ok &= fread(&word, sizeof(word), 1, f) == 1;
+        if (ok && word > CHECKPOINT_MAX_KEY)
+            return -1;
+        ok = ok && fread(key, 1, word, f) == word;
+        if (ok && (word != key_len || memcmp(key, image, key_len)))
+        {
+            fprintf(stderr, "Checkpoint: Taken from a different image (%.*s)\n", (int)word, key);
+            return -1;
+        }
+
+        ok &= fread(words, sizeof(uint32_t), CHECKPOINT_CPU_WORDS, f) == CHECKPOINT_CPU_WORDS;
+        if (ok)
+            checkpoint_cpu_unpack(words, &cpu);
+
+        uint32_t count = 0;
+        ok &= fread(&count, sizeof(count), 1, f) == 1;
+        if (ok && count > m_regions.size())
+            return -1;
+        for (uint32_t j=0;ok && j<count;j++)
+        {
+            uint32_t base;
+
+            ok &= fread(&base, sizeof(base), 1, f) == 1;
+            ok &= fread(&word, sizeof(word), 1, f) == 1;
+            if (ok && (word == 0 || word > MAX_DEVICE_STATE))
+                return -1;
+            if (ok)
+            {
+                devices[base].resize(word);
+                ok &= fread(&devices[base][0], sizeof(uint32_t), word, f) == word;
+            }
+        }
+
+        ok &= fread(&word, sizeof(word), 1, f) == 1;
+        if (ok && word > (1U << (32 - PAGE_SHIFT)))
+            return -1;
+        if (ok)
+        {
+            addrs.resize(word);
+            data.resize((size_t)word * PAGE_SIZE);
+        }
+        for (uint32_t i=0;ok && i<addrs.size();i++)
+        {
+            ok &= fread(&addrs[i], sizeof(uint32_t), 1, f) == 1;
+            ok &= fread(&data[(size_t)i * PAGE_SIZE], 1, PAGE_SIZE, f) == PAGE_SIZE;
+        }
+
+        ok &= fread(&word, sizeof(word), 1, f) == 1 && word == CHECKPOINT_END;
+
+        // Incomplete record
+        if (!ok)
+        {
+            fseek(f, pos, SEEK_SET);
+            break;
+        }
+
+        for (uint32_t i=0;i<addrs.size();i++)
+        {
+            armv6m_page_modify(addrs[i]);
+            armv6m_page_copy(addrs[i], &data[(size_t)i * PAGE_SIZE], true);
+        }
+
+        armv6m_restore_devices(devices);
+        armv6m_restore_cpu(&cpu);
+        records++;
+    }
+
+    if (records)
+        armv6m_memo_flush();
+
+    return records;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <elf.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// ELF core dumps
+//
+// The file holds an NT_PRSTATUS note with the registers (R0-R15 as
+// the GDB stub reports them, then xPSR) followed by a PT_LOAD segment
+// per run of pages to keep. Pages of plain memory which are all zero
+// (never written - reading them does not allocate anything) and not
+// dirty are left out, so the dump scales with the memory in use.
+// Devices are not dumped.
+//-----------------------------------------------------------------
+#define CORE_PRSTATUS_SIZE      148 // ARM struct elf_prstatus
+#define CORE_PRSTATUS_CURSIG    12
+#define CORE_PRSTATUS_REGS      72
+#define CORE_NUM_REGS           18  // R0-R15, CPSR (xPSR), ORIG_R0
+#define CORE_NOTE_NAME          "CORE"
+
+#define CORE_SIGTRAP            5
+#define CORE_SIGSEGV            11
+
+struct tCoreSegment
+{
+    uint32_t addr;
+    uint32_t size;
+};
+
+//-----------------------------------------------------------------
+// core_page_zero: Page (chunk) contents all zero
+//-----------------------------------------------------------------
+static bool core_page_zero(const uint8_t *p, uint32_t len)
+{
+    uint64_t acc = 0;
+    uint32_t i   = 0;
+
+    for (;i + 8 <= len;i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        acc |= w;
+
+        // Exit early at the end of each cache line
+        if (((i & 63) == 56) && acc)
+            return false;
+    }
+
+    for (;i<len;i++)
+        acc |= p[i];
+
+    return acc == 0;
+}
+//-----------------------------------------------------------------
+// core_dump: Write ELF core file of the machine state
+//-----------------------------------------------------------------
+bool Armv6m::core_dump(FILE *f)
+{
+    std::vector <tCoreSegment> segments;
+
+    // Pages to dump (merged into runs)
+    for (std::vector<tMemRegion>::iterator it = m_regions.begin(); it != m_regions.end(); ++it)
+    {
+        uint8_t *buf = it->mem->get_buffer();
+        if (!buf)
+            continue;
+
+        uint64_t end = (uint64_t)it->base + it->size;
+        for (uint64_t addr = it->base; addr < end;)
+        {
+            uint64_t next = (addr & ~(uint64_t)PAGE_MASK) + PAGE_SIZE;
+            if (next > end)
+                next = end;
+
+            uint32_t len   = (uint32_t)(next - addr);
+            tPage   *page  = armv6m_page((uint32_t)addr);
+            bool     dirty = m_dirty_tracking && page && !(page->flags & PAGE_CLEAN);
+
+            if (dirty || !core_page_zero(buf + (addr - it->base), len))
+            {
+                if (!segments.empty() && (uint64_t)segments.back().addr + segments.back().size == addr)
+                    segments.back().size += len;
+                else
+                {
+                    tCoreSegment seg;
+                    seg.addr = (uint32_t)addr;
+                    seg.size = len;
+                    segments.push_back(seg);
+                }
+            }
+
+            addr = next;
+        }
+    }
+
+    // Registers
+    uint8_t prstatus[CORE_PRSTATUS_SIZE];
+    uint32_t regs[CORE_NUM_REGS];
+    uint16_t cursig = (m_stop_reason == STOP_FAULT || m_fault) ? CORE_SIGSEGV : CORE_SIGTRAP;
+
+    for (int i=0;i<REGISTERS;i++)
+        regs[i] = get_register(i);
+    regs[16] = m_apsr | m_ipsr | m_epsr | (1 << 24); // xPSR (Thumb)
+    regs[17] = regs[0];
+
+    memset(prstatus, 0, sizeof(prstatus));
+    memcpy(prstatus + CORE_PRSTATUS_CURSIG, &cursig, sizeof(cursig));
+    memcpy(prstatus + CORE_PRSTATUS_REGS, regs, sizeof(regs));
+
+    Elf32_Nhdr note;
+    note.n_namesz = sizeof(CORE_NOTE_NAME);
+    note.n_descsz = sizeof(prstatus);
+    note.n_type   = NT_PRSTATUS;
+
+    uint32_t note_size = sizeof(note) + ((sizeof(CORE_NOTE_NAME) + 3) & ~3) + sizeof(prstatus);
+
+    // Headers (more than PN_XNUM segments: count is in section 0)
+    uint32_t phnum     = 1 + segments.size();
+    bool     xnum      = phnum >= PN_XNUM;
+    uint32_t phoff     = sizeof(Elf32_Ehdr) + (xnum ? sizeof(Elf32_Shdr) : 0);
+    uint32_t note_off  = phoff + phnum * sizeof(Elf32_Phdr);
+    uint32_t data_off  = (note_off + note_size + PAGE_MASK) & ~PAGE_MASK;
+
+    Elf32_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS]   = ELFCLASS32;
+    ehdr.e_ident[EI_DATA]    = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type      = ET_CORE;
+    ehdr.e_machine   = EM_ARM;
+    ehdr.e_version   = EV_CURRENT;
+    ehdr.e_phoff     = phoff;
+    ehdr.e_shoff     = xnum ? sizeof(Elf32_Ehdr) : 0;
+    ehdr.e_ehsize    = sizeof(Elf32_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    ehdr.e_phnum     = xnum ? PN_XNUM : phnum;
+    ehdr.e_shentsize = xnum ? sizeof(Elf32_Shdr) : 0;
+    ehdr.e_shnum     = xnum ? 1 : 0;
+
+    bool ok = fwrite(&ehdr, sizeof(ehdr), 1, f) == 1;
+
+    if (xnum)
+    {
+        Elf32_Shdr shdr;
+        memset(&shdr, 0, sizeof(shdr));
+        shdr.sh_info = phnum;
+        ok &= fwrite(&shdr, sizeof(shdr), 1, f) == 1;
+    }
+
+    Elf32_Phdr phdr;
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type   = PT_NOTE;
+    phdr.p_offset = note_off;
+    phdr.p_filesz = note_size;
+    ok &= fwrite(&phdr, sizeof(phdr), 1, f) == 1;
+
+    uint32_t offset = data_off;
+    for (std::vector<tCoreSegment>::iterator it = segments.begin(); it != segments.end(); ++it)
+    {
+        memset(&phdr, 0, sizeof(phdr));
+        phdr.p_type   = PT_LOAD;
+        phdr.p_offset = offset;
+        phdr.p_vaddr  = it->addr;
+        phdr.p_paddr  = it->addr;
+        phdr.p_filesz = it->size;
+        phdr.p_memsz  = it->size;
+        phdr.p_flags  = PF_R | PF_W | PF_X;
+        phdr.p_align  = PAGE_SIZE;
+        ok &= fwrite(&phdr, sizeof(phdr), 1, f) == 1;
+
+        offset += it->size;
+    }
+
+    // Note
+    static const uint8_t pad[PAGE_SIZE] = { 0 };
+    ok &= fwrite(&note, sizeof(note), 1, f) == 1;
+    ok &= fwrite(CORE_NOTE_NAME, sizeof(CORE_NOTE_NAME), 1, f) == 1;
+    ok &= fwrite(pad, ((sizeof(CORE_NOTE_NAME) + 3) & ~3) - sizeof(CORE_NOTE_NAME), 1, f) == 1;
+    ok &= fwrite(prstatus, sizeof(prstatus), 1, f) == 1;
+    if (data_off > note_off + note_size)
+        ok &= fwrite(pad, data_off - (note_off + note_size), 1, f) == 1;
+
+    // Memory (straight from the region buffers)
+    for (std::vector<tCoreSegment>::iterator it = segments.begin(); ok && it != segments.end(); ++it)
+    {
+        uint32_t addr = it->addr;
+        uint32_t left = it->size;
+
+        while (ok && left > 0)
+        {
+            int idx = armv6m_find_region(addr);
+            assert(idx >= 0);
+
+            const tMemRegion &region = m_regions[idx];
+            uint32_t len = region.base + (region.size - 1) - addr + 1;
+            if (len > left)
+                len = left;
+
+            ok &= fwrite(region.mem->get_buffer() + (addr - region.base), 1, len, f) == len;
+            addr += len;
+            left -= len;
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,790 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m_lanes.h"
+
+//-----------------------------------------------------------------
+// SIMD kernel is built for each instruction set, picked at load time
+//-----------------------------------------------------------------
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define LANES_SIMD  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LANES_SIMD
+#endif
+
+typedef int32_t tLaneVecS __attribute__((vector_size(LANES_MAX * sizeof(int32_t))));
+
+//-----------------------------------------------------------------
+// Instructions executed across lanes
+//-----------------------------------------------------------------
+typedef enum
+{
+    LOP_NOP = 0,
+    // Rd = Rn + Op2 + carry, all flags (CMP / CMN: flags only)
+    LOP_ADDS_IMM,
+    LOP_ADDS_REG,
+    LOP_SUBS_IMM,
+    LOP_SUBS_REG,
+    LOP_ADCS,
+    LOP_SBCS,
+    LOP_RSBS,
+    LOP_CMP_IMM,
+    LOP_CMP_REG,
+    LOP_CMN_REG,
+    // Rd = f(Rn, Rm / imm), N & Z (TST: flags only)
+    LOP_MOVS_IMM,
+    LOP_MOVS_REG,
+    LOP_ANDS,
+    LOP_EORS,
+    LOP_ORRS,
+    LOP_BICS,
+    LOP_MVNS,
+    LOP_MULS,
+    LOP_TST,
+    // Shift by immediate (1-31), N, Z & C
+    LOP_LSLS_IMM,
+    LOP_LSRS_IMM,
+    LOP_ASRS_IMM,
+    // No flags
+    LOP_MOV,
+    LOP_MOV_IMM,
+    LOP_ADD_REG,
+    LOP_ADD_IMM,
+    LOP_UXTB,
+    LOP_UXTH,
+    LOP_SXTB,
+    LOP_SXTH,
+    LOP_REV,
+    LOP_REV16,
+    LOP_REVSH,
+    // Branches (per lane target)
+    LOP_B,
+    LOP_BL,
+    LOP_BCC,
+    LOP_BX,
+    LOP_BLX,
+    LOP_CBZ,
+    LOP_CBNZ,
+    // Memory (per lane host address, see lanes_memory)
+    LOP_LDR,
+    LOP_LDRH,
+    LOP_LDRSH,
+    LOP_LDRB,
+    LOP_LDRSB,
+    LOP_STR,
+    LOP_STRH,
+    LOP_STRB,
+    LOP_PUSH,
+    LOP_POP
+} tLaneOpcode;
+
+struct tLaneOp
+{
+    tLaneOpcode op;
+    uint32_t    rd;
+    uint32_t    rn;
+    uint32_t    rm;
+    uint32_t    imm;
+    uint32_t    cond;
+    uint32_t    next;   // PC of the next instruction
+    uint32_t    target; // Branch target / link (BL, BLX)
+    uint32_t    link;
+    uint32_t    size;   // Access size (memory)
+    bool        index;  // Address is Rn + Rm (else Rn + imm)
+    uint32_t    reglist;
+};
+
+//-----------------------------------------------------------------
+// lanes_execute: Execute op for the lanes in mask (all ones / zero
+// per lane). PC is written for every lane in the mask.
+//-----------------------------------------------------------------
+static LANES_SIMD void lanes_execute(const tLaneOp *op, const tLaneVec *mask, tLaneVec *reg, tLaneVec *apsr)
+{
+    const tLaneVec zero = { };
+    tLaneVec m      = *mask;
+    tLaneVec rn     = reg[op->rn];
+    tLaneVec rm     = reg[op->rm];
+    tLaneVec a      = rn;
+    tLaneVec b      = rm;
+    tLaneVec res    = rn;
+    tLaneVec flags  = *apsr;
+    tLaneVec pc     = zero + op->next;
+    tLaneVec carry  = (flags >> APSR_C_SHIFT) & 1;
+    uint32_t fmask  = 0;
+    bool     write  = true;
+
+    switch (op->op)
+    {
+        case LOP_NOP:
+            write = false;
+            break;
+        case LOP_ADDS_IMM: a = rn;  b = zero + op->imm;  res = a + b;          fmask = ALL_FLAGS; break;
+        case LOP_ADDS_REG: a = rn;  b = rm;              res = a + b;          fmask = ALL_FLAGS; break;
+        case LOP_SUBS_IMM: a = rn;  b = zero + ~op->imm; res = a + b + 1;      fmask = ALL_FLAGS; break;
+        case LOP_SUBS_REG: a = rn;  b = ~rm;             res = a + b + 1;      fmask = ALL_FLAGS; break;
+        case LOP_ADCS:     a = rn;  b = rm;              res = a + b + carry;  fmask = ALL_FLAGS; break;
+        case LOP_SBCS:     a = rn;  b = ~rm;             res = a + b + carry;  fmask = ALL_FLAGS; break;
+        case LOP_RSBS:     a = ~rn; b = zero;            res = a + b + 1;      fmask = ALL_FLAGS; break;
+        case LOP_CMP_IMM:  a = rn;  b = zero + ~op->imm; res = a + b + 1;      fmask = ALL_FLAGS; write = false; break;
+        case LOP_CMP_REG:  a = rn;  b = ~rm;             res = a + b + 1;      fmask = ALL_FLAGS; write = false; break;
+        case LOP_CMN_REG:  a = rn;  b = rm;              res = a + b;          fmask = ALL_FLAGS; write = false; break;
+
+        case LOP_MOVS_IMM: res = zero + op->imm;    fmask = APSR_N | APSR_Z; break;
+        case LOP_MOVS_REG: res = rm;                fmask = APSR_N | APSR_Z; break;
+        case LOP_ANDS:     res = rn & rm;           fmask = APSR_N | APSR_Z; break;
+        case LOP_EORS:     res = rn ^ rm;           fmask = APSR_N | APSR_Z; break;
+        case LOP_ORRS:     res = rn | rm;           fmask = APSR_N | APSR_Z; break;
+        case LOP_BICS:     res = rn & ~rm;          fmask = APSR_N | APSR_Z; break;
+        case LOP_MVNS:     res = ~rm;               fmask = APSR_N | APSR_Z; break;
+        case LOP_MULS:     res = rn * rm;           fmask = APSR_N | APSR_Z; break;
+        case LOP_TST:      res = rn & rm;           fmask = APSR_N | APSR_Z; write = false; break;
+
+        case LOP_LSLS_IMM:
+            res   = rm << op->imm;
+            carry = (rm >> (32 - op->imm)) & 1;
+            fmask = FLAGS_NZC;
+            break;
+        case LOP_LSRS_IMM:
+            res   = rm >> op->imm;
+            carry = (rm >> (op->imm - 1)) & 1;
+            fmask = FLAGS_NZC;
+            break;
+        case LOP_ASRS_IMM:
+            res   = (tLaneVec)((tLaneVecS)rm >> op->imm);
+            carry = (rm >> (op->imm - 1)) & 1;
+            fmask = FLAGS_NZC;
+            break;
+
+        case LOP_MOV:      res = rm;                break;
+        case LOP_MOV_IMM:  res = zero + op->imm;    break;
+        case LOP_ADD_REG:  res = rn + rm;           break;
+        case LOP_ADD_IMM:  res = rn + op->imm;      break;
+        case LOP_UXTB:     res = rm & 0xFF;         break;
+        case LOP_UXTH:     res = rm & 0xFFFF;       break;
+        case LOP_SXTB:     res = (tLaneVec)(((tLaneVecS)(rm << 24)) >> 24); break;
+        case LOP_SXTH:     res = (tLaneVec)(((tLaneVecS)(rm << 16)) >> 16); break;
+        case LOP_REV:
+            res = (rm << 24) | ((rm & 0xFF00) << 8) | ((rm >> 8) & 0xFF00) | (rm >> 24);
+            break;
+        case LOP_REV16:
+            res = ((rm & 0x00FF00FF) << 8) | ((rm >> 8) & 0x00FF00FF);
+            break;
+        case LOP_REVSH:
+            res = (tLaneVec)(((tLaneVecS)(rm << 24)) >> 16) | ((rm >> 8) & 0xFF);
+            break;
+
+        case LOP_B:
+            pc    = zero + op->target;
+            write = false;
+            break;
+        case LOP_BL:
+            pc    = zero + op->target;
+            res   = zero + op->link;
+            break;
+        case LOP_BX:
+            pc    = rm & ~1;
+            write = false;
+            break;
+        case LOP_BLX:
+            pc    = rm & ~1;
+            res   = zero + op->link;
+            break;
+        case LOP_CBZ:
+        case LOP_CBNZ:
+        {
+            tLaneVec take = (tLaneVec)(rn == 0);
+            if (op->op == LOP_CBNZ)
+                take = ~take;
+
+            pc    = (take & op->target) | (~take & pc);
+            write = false;
+        }
+        break;
+        case LOP_BCC:
+        {
+            tLaneVec n = (flags >> APSR_N_SHIFT) & 1;
+            tLaneVec z = (flags >> APSR_Z_SHIFT) & 1;
+            tLaneVec c = (flags >> APSR_C_SHIFT) & 1;
+            tLaneVec v = (flags >> APSR_V_SHIFT) & 1;
+            tLaneVec take;
+
+            switch (op->cond)
+            {
+                case 0:  take = z;                  break; // EQ
+                case 1:  take = z ^ 1;              break; // NE
+                case 2:  take = c;                  break; // CS/HS
+                case 3:  take = c ^ 1;              break; // CC/LO
+                case 4:  take = n;                  break; // MI
+                case 5:  take = n ^ 1;              break; // PL
+                case 6:  take = v;                  break; // VS
+                case 7:  take = v ^ 1;              break; // VC
+                case 8:  take = c & (z ^ 1);        break; // HI
+                case 9:  take = (c ^ 1) | z;        break; // LS
+                case 10: take = (n ^ v) ^ 1;        break; // GE
+                case 11: take = n ^ v;              break; // LT
+                case 12: take = (z | (n ^ v)) ^ 1;  break; // GT
+                default: take = z | (n ^ v);        break; // LE
+            }
+
+            // 0/1 to all zeros / ones
+            take  = -take;
+            pc    = (take & op->target) | (~take & pc);
+            write = false;
+        }
+        break;
+        default:
+            // Memory: lanes_memory
+            write = false;
+            break;
+    }
+
+    // Flags
+    if (fmask)
+    {
+        tLaneVec f = (res & APSR_N) | ((tLaneVec)(res == 0) & APSR_Z);
+
+        if (fmask & APSR_V)
+        {
+            // Carry / overflow out of bit 31 of a + b (+ carry in)
+            f |= (((a & b) | ((a | b) & ~res)) >> 31) << APSR_C_SHIFT;
+            f |= (((a ^ res) & (b ^ res)) >> 31) << APSR_V_SHIFT;
+        }
+        else if (fmask & APSR_C)
+            f |= carry << APSR_C_SHIFT;
+
+        tLaneVec fm = m & fmask;
+        *apsr = (flags & ~fm) | (f & fm);
+    }
+
+    if (write)
+        reg[op->rd] = (res & m) | (reg[op->rd] & ~m);
+
+    reg[REG_PC] = (pc & m) | (reg[REG_PC] & ~m);
+}
+//-----------------------------------------------------------------
+// Construction
+//-----------------------------------------------------------------
+Armv6mLanes::Armv6mLanes()
+{
+    memset(m_reg, 0, sizeof(m_reg));
+    memset(&m_apsr, 0, sizeof(m_apsr));
+
+    m_lanes        = 0;
+    m_vector_insts = 0;
+    m_scalar_insts = 0;
+    m_runnable     = 0;
+    m_max_insts    = 0;
+}
+//-----------------------------------------------------------------
+// add_lane: Add an instance to run (same architecture as the others)
+//-----------------------------------------------------------------
+int Armv6mLanes::add_lane(Armv6m *cpu)
+{
+    if (m_lanes >= LANES_MAX || (m_lanes && cpu->m_arch != m_cpu[0]->m_arch))
+        return -1;
+
+    for (int i=0;i<m_lanes;i++)
+        if (m_cpu[i] == cpu)
+            return -1;
+
+    m_cpu[m_lanes] = cpu;
+    return m_lanes++;
+}
+//-----------------------------------------------------------------
+// lanes_gather: Lane registers from its instance
+//-----------------------------------------------------------------
+void Armv6mLanes::lanes_gather(int lane)
+{
+    Armv6m *cpu = m_cpu[lane];
+
+    for (int i=0;i<REGISTERS;i++)
+        m_reg[i][lane] = cpu->m_regfile[i];
+    m_apsr[lane] = cpu->m_apsr;
+}
+//-----------------------------------------------------------------
+// lanes_scatter: Lane registers back to its instance
+//-----------------------------------------------------------------
+void Armv6mLanes::lanes_scatter(int lane)
+{
+    Armv6m *cpu = m_cpu[lane];
+
+    for (int i=0;i<REGISTERS;i++)
+        cpu->m_regfile[i] = m_reg[i][lane];
+    cpu->m_apsr = m_apsr[lane];
+}
+//-----------------------------------------------------------------
+// lanes_runnable: Lane has not finished
+//-----------------------------------------------------------------
+bool Armv6mLanes::lanes_runnable(int lane)
+{
+    Armv6m *cpu = m_cpu[lane];
+
+    return cpu->m_stop_reason == STOP_NONE && !cpu->m_fault && !cpu->m_break && cpu->m_inst_count < m_max_insts;
+}
+//-----------------------------------------------------------------
+// lanes_scalar_step: Step one lane on its own
+//-----------------------------------------------------------------
+void Armv6mLanes::lanes_scalar_step(int lane)
+{
+    lanes_scatter(lane);
+    m_cpu[lane]->step();
+    lanes_gather(lane);
+
+    if (!lanes_runnable(lane))
+        m_runnable &= ~(1 << lane);
+
+    m_scalar_insts++;
+}
+//-----------------------------------------------------------------
+// lanes_memory: Load / store for the lanes in mask, provided every
+// lane's access is to plain memory (the fast path of Armv6m::load /
+// store). Returns false (nothing done) otherwise.
+//-----------------------------------------------------------------
+bool Armv6mLanes::lanes_memory(const tLaneOp *op, uint32_t mask)
+{
+    uint8_t *host[LANES_MAX];
+    uint32_t addr[LANES_MAX];
+    uint32_t len   = op->size;
+    bool     write = (op->op == LOP_STR || op->op == LOP_STRH || op->op == LOP_STRB || op->op == LOP_PUSH);
+
+    if (op->op == LOP_PUSH || op->op == LOP_POP)
+        len = 4 * __builtin_popcount(op->reglist);
+
+    for (int l=0;l<m_lanes;l++)
+    {
+        if (!(mask & (1 << l)))
+            continue;
+
+        Armv6m  *cpu  = m_cpu[l];
+        uint32_t slow = write ? cpu->m_slow_write : cpu->m_slow_read;
+        uint32_t a;
+
+        if (op->op == LOP_PUSH)
+            a = m_reg[REG_SP][l] - len;
+        else if (op->op == LOP_POP)
+            a = m_reg[REG_SP][l];
+        else
+            a = m_reg[op->rn][l] + (op->index ? m_reg[op->rm][l] : op->imm);
+
+        // Unaligned (faults), or a PUSH / POP running off the page
+        if (!len || (a & (op->size - 1)) || ((a ^ (a + len - 1)) & ~PAGE_MASK))
+            return false;
+
+        host[l] = cpu->armv6m_host_addr(a, slow);
+        if (!host[l] || (len > op->size && !cpu->armv6m_host_addr(a + len - 1, slow)))
+            return false;
+
+        addr[l] = a;
+    }
+
+    for (int l=0;l<m_lanes;l++)
+    {
+        if (!(mask & (1 << l)))
+            continue;
+
+        uint8_t *p  = host[l];
+        uint32_t pc = op->next;
+
+        switch (op->op)
+        {
+            case LOP_LDR:   { uint32_t v; memcpy(&v, p, 4); m_reg[op->rd][l] = v; } break;
+            case LOP_LDRH:  { uint16_t v; memcpy(&v, p, 2); m_reg[op->rd][l] = v; } break;
+            case LOP_LDRSH: { int16_t  v; memcpy(&v, p, 2); m_reg[op->rd][l] = v; } break;
+            case LOP_LDRB:  m_reg[op->rd][l] = *p;           break;
+            case LOP_LDRSB: m_reg[op->rd][l] = (int8_t)*p;   break;
+            case LOP_STR:   { uint32_t v = m_reg[op->rd][l]; memcpy(p, &v, 4); } break;
+            case LOP_STRH:  { uint16_t v = m_reg[op->rd][l]; memcpy(p, &v, 2); } break;
+            case LOP_STRB:  *p = (uint8_t)m_reg[op->rd][l];  break;
+            case LOP_PUSH:
+                for (int i=0;i<REGISTERS;i++)
+                {
+                    if (!(op->reglist & (1 << i)))
+                        continue;
+
+                    uint32_t v = m_reg[i][l];
+                    memcpy(p, &v, 4);
+                    p += 4;
+                }
+                m_reg[REG_SP][l] = addr[l];
+                break;
+            case LOP_POP:
+                for (int i=0;i<REGISTERS;i++)
+                {
+                    if (!(op->reglist & (1 << i)))
+                        continue;
+
+                    uint32_t v;
+                    memcpy(&v, p, 4);
+                    p += 4;
+
+                    if (i == REG_PC)
+                    {
+                        if ((v & EXC_RETURN) != EXC_RETURN)
+                            v &= ~1;
+                        pc = v;
+                    }
+                    else
+                        m_reg[i][l] = v;
+                }
+                m_reg[REG_SP][l] = addr[l] + len;
+                break;
+            default:
+                break;
+        }
+
+        m_reg[REG_PC][l] = pc;
+    }
+
+    return true;
+}
+//-----------------------------------------------------------------
+// lanes_vector_step: Execute the instruction at pc for the lanes in
+// mask at once. Returns false (nothing done) if the lanes need to be
+// stepped individually.
+//-----------------------------------------------------------------
+bool Armv6mLanes::lanes_vector_step(uint32_t pc, uint32_t mask)
+{
+    uint16_t inst  = 0;
+    uint16_t inst2 = 0;
+    int      first = -1;
+
+    if ((pc & 1) || (pc & EXC_RETURN) == EXC_RETURN)
+        return false;
+
+    // Same instruction from plain memory in every lane
+    for (int l=0;l<m_lanes;l++)
+    {
+        if (!(mask & (1 << l)))
+            continue;
+
+        Armv6m *cpu = m_cpu[l];
+        if (!m_vector_ok[l] || cpu->m_fault_pending)
+            return false;
+
+        uint8_t *host = cpu->armv6m_host_addr(pc, cpu->m_slow_fetch);
+        if (!host)
+            return false;
+
+        uint16_t lane_inst;
+        memcpy(&lane_inst, host, sizeof(lane_inst));
+
+        if (first < 0)
+        {
+            first = l;
+            inst  = lane_inst;
+        }
+        else if (lane_inst != inst)
+            return false;
+    }
+
+    Armv6m *cpu = m_cpu[first];
+    tLaneOp op;
+
+    memset(&op, 0, sizeof(op));
+    op.next = pc + 2;
+
+    // BL (the only 32-bit instruction handled here)
+    if ((inst & INST_IGRP1_MASK) == INST_BL_OPCODE)
+    {
+        for (int l=0;l<m_lanes;l++)
+        {
+            if (!(mask & (1 << l)))
+                continue;
+
+            uint8_t *host = m_cpu[l]->armv6m_host_addr(pc + 2, m_cpu[l]->m_slow_fetch);
+            if (!host)
+                return false;
+
+            uint16_t lane_inst;
+            memcpy(&lane_inst, host, sizeof(lane_inst));
+            if (l == first)
+                inst2 = lane_inst;
+            else if (lane_inst != inst2)
+                return false;
+        }
+
+        // BL: 1 1 J1 1 J2 (B.W, MSR, ... stepped individually)
+        if ((inst2 & 0xD000) != 0xD000)
+            return false;
+
+        uint32_t offset = cpu->armv6m_sign_extend(inst & 0x7FF, 11);
+        offset <<= 11;
+        offset  |= inst2 & 0x7FF;
+        offset <<= 1;
+
+        op.op     = LOP_BL;
+        op.rd     = REG_LR;
+        op.target = pc + 4 + offset;
+        op.link   = (pc + 4) | 1;
+    }
+    else
+    {
+        // 32-bit
+        if (cpu->armv6m_decode_cached(inst))
+            return false;
+
+        op.rd   = cpu->m_rd;
+        op.rn   = cpu->m_rn;
+        op.rm   = cpu->m_rm;
+        op.imm  = cpu->m_imm;
+        op.cond = cpu->m_cond;
+
+        bool ok = true;
+
+        switch (cpu->m_inst_group)
+        {
+        case INST_IGRP0:
+            // BCC (not AL / SVC)
+            if ((inst & INST_IGRP0_MASK) != INST_BCC_OPCODE || op.cond >= 14)
+                ok = false;
+            else
+            {
+                op.op     = LOP_BCC;
+                op.target = pc + 4 + (cpu->armv6m_sign_extend(op.imm, 8) << 1);
+            }
+            break;
+        case INST_IGRP1:
+            switch (inst & INST_IGRP1_MASK)
+            {
+                case INST_ADDS_1_OPCODE: op.op = LOP_ADDS_IMM; break;
+                case INST_SUBS_1_OPCODE: op.op = LOP_SUBS_IMM; break;
+                case INST_CMP_OPCODE:    op.op = LOP_CMP_IMM;  break;
+                case INST_MOVS_OPCODE:   op.op = LOP_MOVS_IMM; break;
+                case INST_ADD_1_OPCODE:  op.op = LOP_ADD_IMM; op.imm <<= 2; break;
+                case INST_ADR_OPCODE:    op.op = LOP_MOV_IMM; op.imm += pc + 4; break;
+                case INST_LSLS_OPCODE:   op.op = op.imm ? LOP_LSLS_IMM : LOP_MOVS_REG; break;
+                case INST_LSRS_OPCODE:   op.op = LOP_LSRS_IMM; ok = op.imm != 0; break;
+                case INST_ASRS_OPCODE:   op.op = LOP_ASRS_IMM; ok = op.imm != 0; break;
+                case INST_B_OPCODE:
+                    op.op     = LOP_B;
+                    op.target = pc + 4 + (cpu->armv6m_sign_extend(op.imm, 11) << 1);
+                    break;
+                case INST_LDR_OPCODE:    op.op = LOP_LDR;  op.size = 4; op.imm <<= 2; break;
+                case INST_LDRH_OPCODE:   op.op = LOP_LDRH; op.size = 2; op.imm <<= 1; break;
+                case INST_LDRB_OPCODE:   op.op = LOP_LDRB; op.size = 1; break;
+                case INST_STR_OPCODE:    op.op = LOP_STR;  op.size = 4; op.imm <<= 2; break;
+                case INST_STRH_OPCODE:   op.op = LOP_STRH; op.size = 2; op.imm <<= 1; break;
+                case INST_STRB_OPCODE:   op.op = LOP_STRB; op.size = 1; break;
+                case INST_LDR_1_OPCODE:  op.op = LOP_LDR;  op.size = 4; op.imm <<= 2; break;
+                case INST_STR_1_OPCODE:  op.op = LOP_STR;  op.size = 4; op.imm <<= 2; break;
+                case INST_LDR_2_OPCODE:
+                    // Literal: Align(PC, 4) + 4 + imm, as an offset from PC
+                    op.op   = LOP_LDR;
+                    op.size = 4;
+                    op.rn   = REG_PC;
+                    op.imm  = (pc & ~3) + 4 + (op.imm << 2) - pc;
+                    break;
+                default:                 ok = false; break;
+            }
+            break;
+        case INST_IGRP2:
+            switch (inst & INST_IGRP2_MASK)
+            {
+                case INST_ADDS_OPCODE:   op.op = LOP_ADDS_IMM; break;
+                case INST_ADDS_2_OPCODE: op.op = LOP_ADDS_REG; break;
+                case INST_SUBS_OPCODE:   op.op = LOP_SUBS_IMM; break;
+                case INST_SUBS_2_OPCODE: op.op = LOP_SUBS_REG; break;
+                case INST_LDR_3_OPCODE:  op.op = LOP_LDR;   op.size = 4; op.index = true; break;
+                case INST_LDRH_1_OPCODE: op.op = LOP_LDRH;  op.size = 2; op.index = true; break;
+                case INST_LDRSH_OPCODE:  op.op = LOP_LDRSH; op.size = 2; op.index = true; break;
+                case INST_LDRB_1_OPCODE: op.op = LOP_LDRB;  op.size = 1; op.index = true; break;
+                case INST_LDRSB_OPCODE:  op.op = LOP_LDRSB; op.size = 1; op.index = true; break;
+                case INST_STR_2_OPCODE:  op.op = LOP_STR;   op.size = 4; op.index = true; break;
+                case INST_STRH_1_OPCODE: op.op = LOP_STRH;  op.size = 2; op.index = true; break;
+                case INST_STRB_1_OPCODE: op.op = LOP_STRB;  op.size = 1; op.index = true; break;
+                case INST_PUSH_OPCODE:   op.op = LOP_PUSH;  op.size = 4; op.reglist = cpu->m_reglist; break;
+                case INST_POP_OPCODE:    op.op = LOP_POP;   op.size = 4; op.reglist = cpu->m_reglist; break;
+                default:                 ok = false; break;
+            }
+            break;
+        case INST_IGRP3:
+            switch (inst & INST_IGRP3_MASK)
+            {
+                case INST_ADD_OPCODE:    op.op = LOP_ADD_REG; ok = op.rd != REG_PC; break;
+                case INST_CMP_2_OPCODE:  op.op = LOP_CMP_REG; break;
+                case INST_MOV_OPCODE:    op.op = (op.rd == REG_PC) ? LOP_BX : LOP_MOV; break;
+                default:                 ok = false; break;
+            }
+            break;
+        case INST_IGRP4:
+            switch (inst & INST_IGRP4_MASK)
+            {
+                case INST_ADD_2_OPCODE:  op.op = LOP_ADD_IMM; op.imm <<= 2; break;
+                case INST_SUB_OPCODE:    op.op = LOP_ADD_IMM; op.imm = -(op.imm << 2); break;
+                case INST_BX_OPCODE:     op.op = LOP_BX; break;
+                case INST_BLX_OPCODE:    op.op = LOP_BLX; op.rd = REG_LR; op.link = (pc + 2) | 1; break;
+                default:                 ok = false; break;
+            }
+            break;
+        case INST_IGRP5:
+            switch (inst & INST_IGRP5_MASK)
+            {
+                case INST_ADCS_OPCODE:   op.op = LOP_ADCS;  break;
+                case INST_SBCS_OPCODE:   op.op = LOP_SBCS;  break;
+                case INST_RSBS_OPCODE:   op.op = LOP_RSBS;  break;
+                case INST_CMN_OPCODE:    op.op = LOP_CMN_REG; break;
+                case INST_CMP_1_OPCODE:  op.op = LOP_CMP_REG; break;
+                case INST_ANDS_OPCODE:   op.op = LOP_ANDS;  break;
+                case INST_EORS_OPCODE:   op.op = LOP_EORS;  break;
+                case INST_ORRS_OPCODE:   op.op = LOP_ORRS;  break;
+                case INST_BICS_OPCODE:   op.op = LOP_BICS;  break;
+                case INST_MVNS_OPCODE:   op.op = LOP_MVNS;  break;
+                case INST_MULS_OPCODE:   op.op = LOP_MULS;  break;
+                case INST_TST_OPCODE:    op.op = LOP_TST;   break;
+                case INST_UXTB_OPCODE:   op.op = LOP_UXTB;  break;
+                case INST_UXTH_OPCODE:   op.op = LOP_UXTH;  break;
+                case INST_SXTB_OPCODE:   op.op = LOP_SXTB;  break;
+                case INST_SXTH_OPCODE:   op.op = LOP_SXTH;  break;
+                case INST_REV_OPCODE:    op.op = LOP_REV;   break;
+                case INST_REV16_OPCODE:  op.op = LOP_REV16; break;
+                case INST_REVSH_OPCODE:  op.op = LOP_REVSH; break;
+                default:                 ok = false; break;
+            }
+            break;
+        case INST_IGRP8:
+            // Hints
+            op.op = LOP_NOP;
+            break;
+        case INST_IGRP9:
+            // CBZ / CBNZ (forwards only)
+            op.op     = ((inst & INST_IGRP9_MASK) == INST_CBZ_OPCODE) ? LOP_CBZ : LOP_CBNZ;
+            op.target = pc + 4 + (op.imm << 1);
+            break;
+        default:
+            ok = false;
+            break;
+        }
+
+        if (!ok)
+            return false;
+    }
+
+    if (op.op >= LOP_LDR)
+    {
+        if (!lanes_memory(&op, mask))
+            return false;
+    }
+    else
+    {
+        tLaneVec vmask;
+        for (int l=0;l<LANES_MAX;l++)
+            vmask[l] = (mask & (1 << l)) ? ~0U : 0;
+
+        lanes_execute(&op, &vmask, m_reg, &m_apsr);
+    }
+
+    // Written SP also updates the banked copy
+    bool sp_write = (op.op == LOP_PUSH || op.op == LOP_POP) ||
+                    ((op.rd == REG_SP) && (op.op == LOP_MOV || op.op == LOP_ADD_REG || op.op == LOP_ADD_IMM));
+
+    // Per lane: remainder of Armv6m::step
+    for (int l=0;l<m_lanes;l++)
+    {
+        if (!(mask & (1 << l)))
+            continue;
+
+        Armv6m *lane = m_cpu[l];
+
+        if (sp_write)
+        {
+            if ((lane->m_control & CONTROL_SPSEL) && (lane->m_current_mode == MODE_THREAD))
+                lane->m_psp = m_reg[REG_SP][l];
+            else
+                lane->m_msp = m_reg[REG_SP][l];
+        }
+
+        if (lane->m_systick->clock() != -1)
+            lane->m_systick_irq = true;
+
+        if (lane->m_systick_irq && (lane->m_current_mode == MODE_THREAD) && !(lane->m_primask & PRIMASK_PM))
+        {
+            lanes_scatter(l);
+            lane->m_regfile[REG_PC] = lane->armv6m_exception(lane->m_regfile[REG_PC], 15);
+            lane->m_systick_irq = false;
+            lanes_gather(l);
+        }
+
+        lane->m_inst_count++;
+
+        if (lane->m_has_breakpoints && lane->check_breakpoint(m_reg[REG_PC][l]))
+            lane->m_break = true;
+
+        if (lane->m_break || lane->m_inst_count >= m_max_insts)
+            m_runnable &= ~(1 << l);
+
+        m_vector_insts++;
+    }
+
+    return true;
+}
+//-----------------------------------------------------------------
+// run: Run the lanes (see armv6m_lanes.h)
+//-----------------------------------------------------------------
+void Armv6mLanes::run(uint64_t max_insts)
+{
+    m_max_insts = max_insts;
+    m_runnable  = 0;
+
+    for (int l=0;l<m_lanes;l++)
+    {
+        Armv6m *cpu = m_cpu[l];
+
+        lanes_gather(l);
+        m_wait[l]      = 0;
+        m_vector_ok[l] = !cpu->m_trace && !cpu->m_heat && !cpu->m_step_cb && cpu->m_memo_funcs.empty();
+
+        if (lanes_runnable(l))
+            m_runnable |= 1 << l;
+    }
+
+    while (m_runnable)
+    {
+        uint32_t pc   = 0xFFFFFFFF;
+        int      late = -1;
+
+        // Lowest PC first (unless a lane has been waiting too long)
+        for (int l=0;l<m_lanes;l++)
+        {
+            if (!(m_runnable & (1 << l)))
+                continue;
+
+            if (m_reg[REG_PC][l] < pc)
+                pc = m_reg[REG_PC][l];
+            if (m_wait[l] > LANES_MAX_WAIT)
+                late = l;
+        }
+
+        if (late >= 0)
+            pc = m_reg[REG_PC][late];
+
+        uint32_t mask = 0;
+        for (int l=0;l<m_lanes;l++)
+            if ((m_runnable & (1 << l)) && m_reg[REG_PC][l] == pc)
+                mask |= 1 << l;
+
+        // Diverged: count the steps each lane left out has waited
+        if (mask != m_runnable)
+        {
+            for (int l=0;l<m_lanes;l++)
+            {
+                if (mask & (1 << l))
+                    m_wait[l] = 0;
+                else if (m_runnable & (1 << l))
+                    m_wait[l]++;
+            }
+        }
+        else if (late >= 0)
+            memset(m_wait, 0, sizeof(m_wait));
+
+        if (!lanes_vector_step(pc, mask))
+        {
+            for (int l=0;l<m_lanes;l++)
+                if (mask & (1 << l))
+                    lanes_scalar_step(l);
+        }
+    }
+
+    for (int l=0;l<m_lanes;l++)
+        lanes_scatter(l);
+}
@@ -0,0 +1,84 @@
+#ifndef __ARMV6M_LANES_H__
+#define __ARMV6M_LANES_H__
+
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Multi-lane execution
+//
+// Runs several Armv6m instances (lanes) with the same program - e.g.
+// one per fault to inject or input to sweep - in lockstep. The lanes'
+// core registers (R0-R15, APSR) are held structure-of-arrays, and
+// whilst the lanes are converged (same PC, same instruction) ALU and
+// branch instructions execute for every lane at once with SIMD (the
+// widest of AVX-512 / AVX2 / SSE the host has), as do loads / stores
+// which hit plain memory in every lane. Anything else - device or
+// watched accesses, system instructions, exceptions, lanes which have
+// diverged - is stepped by each lane's own Armv6m as normal, so
+// results are exactly those of running the lanes one after another.
+//
+// Diverged lanes are scheduled lowest PC first, which brings lanes
+// that have taken different sides of a branch back together at the
+// join point.
+//
+// Lanes must be distinct instances with the same architecture and
+// their own memory (read-only images may be shared). Lanes with
+// tracing, memoisation, a heatmap or a step callback are always
+// stepped individually.
+//-----------------------------------------------------------------
+#define LANES_MAX           16
+
+// Steps a lane can be left behind before it is run out of turn
+#define LANES_MAX_WAIT      1024
+
+struct tLaneOp;
+
+typedef uint32_t tLaneVec __attribute__((vector_size(LANES_MAX * sizeof(uint32_t))));
+
+//-----------------------------------------------------------------
+// Armv6mLanes: Lockstep executor for up to LANES_MAX lanes
+//-----------------------------------------------------------------
+class Armv6mLanes
+{
+public:
+                        Armv6mLanes();
+
+    // Add a lane (not owned). Returns the lane index or -1.
+    int                 add_lane(Armv6m *cpu);
+    int                 get_lanes(void)         { return m_lanes; }
+    Armv6m             *get_lane(int lane)      { return m_cpu[lane]; }
+
+    // Run until every lane has exited, faulted, hit a breakpoint /
+    // watchpoint (get_break on the lane) or executed max_insts
+    void                run(uint64_t max_insts);
+
+    // Lane instructions executed with SIMD / stepped individually
+    uint64_t            get_vector_insts(void)  { return m_vector_insts; }
+    uint64_t            get_scalar_insts(void)  { return m_scalar_insts; }
+
+protected:
+    bool                lanes_runnable(int lane);
+    bool                lanes_vector_step(uint32_t pc, uint32_t mask);
+    bool                lanes_memory(const tLaneOp *op, uint32_t mask);
+    void                lanes_scalar_step(int lane);
+    void                lanes_gather(int lane);
+    void                lanes_scatter(int lane);
+
+    // Core registers, structure-of-arrays
+    tLaneVec            m_reg[REGISTERS];
+    tLaneVec            m_apsr;
+
+    Armv6m             *m_cpu[LANES_MAX];
+    bool                m_vector_ok[LANES_MAX];
+    uint32_t            m_wait[LANES_MAX];
+    int                 m_lanes;
+
+    // Lanes still to finish (this run) and the instruction limit
+    uint32_t            m_runnable;
+    uint64_t            m_max_insts;
+
+    uint64_t            m_vector_insts;
+    uint64_t            m_scalar_insts;
+};
+
+#endif
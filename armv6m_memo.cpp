@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Memoisation of pure guest functions
+//
+// A registered function is profiled each time it is called with an
+// argument set (R0-R3) that is not yet cached. The call is pure if it
+// only stores to its own stack frame and makes no MMIO accesses.
+// Addresses it reads outside the stack frame are recorded as spans;
+// any later store into a span discards the cached results, so reads
+// need not be from read-only memory to be safe.
+//-----------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// memo_add_function: Register a (candidate) pure function
+//-----------------------------------------------------------------
+bool Armv6m::memo_add_function(uint32_t addr)
+{
+    tMemoFunc func;
+
+    func.addr   = addr & ~1;
+    func.impure = false;
+    func.hits   = 0;
+
+    // Profile state points into the function list
+    m_memo_profiling = false;
+
+    m_memo_funcs.push_back(func);
+    return true;
+}
+//-----------------------------------------------------------------
+// memo_get_hits: Number of calls skipped
+//-----------------------------------------------------------------
+uint64_t Armv6m::memo_get_hits(void)
+{
+    uint64_t hits = 0;
+
+    for (std::vector<tMemoFunc>::iterator it = m_memo_funcs.begin(); it != m_memo_funcs.end(); ++it)
+        hits += it->hits;
+
+    return hits;
+}
+//-----------------------------------------------------------------
+// armv6m_memo_check: Called before each fetch. Completes an active
+// profile when the call returns, or replaces a call to a memoised
+// function with its cached result.
+//-----------------------------------------------------------------
+void Armv6m::armv6m_memo_check(void)
+{
+    uint32_t pc = m_regfile[REG_PC];
+
+    if (m_memo_profiling)
+    {
+        // Returned from profiled call?
+        if (pc != m_memo_ret_pc || m_regfile[REG_SP] != m_memo_entry_sp)
+            return ;
+
+        m_memo_profiling = false;
+
+        if (!m_memo_pure)
+        {
+            m_memo_func->impure = true;
+            return ;
+        }
+
+        if (m_memo_func->results.size() < MEMO_MAX_RESULTS)
+        {
+            tMemoResult res;
+
+            for (int i=0;i<4;i++)
+                res.regs[i] = m_regfile[i];
+            res.regs[4] = m_regfile[12];
+            res.apsr    = m_apsr;
+            res.insts   = (uint32_t)(m_inst_count - m_memo_start);
+
+            m_memo_func->results[m_memo_key] = res;
+        }
+        return ;
+    }
+
+    for (std::vector<tMemoFunc>::iterator it = m_memo_funcs.begin(); it != m_memo_funcs.end(); ++it)
+    {
+        if (it->addr != pc)
+            continue;
+
+        uint32_t lr = m_regfile[REG_LR];
+
+        // Only plain function calls
+        if (it->impure || (lr & EXC_RETURN) == EXC_RETURN)
+            return ;
+
+        tMemoKey key;
+        for (int i=0;i<4;i++)
+            key.args[i] = m_regfile[i];
+
+        std::map<tMemoKey, tMemoResult>::iterator res = it->results.find(key);
+
+        // Hit: return straight to the caller
+        if (res != it->results.end())
+        {
+            for (int i=0;i<4;i++)
+                m_regfile[i] = res->second.regs[i];
+            m_regfile[12]     = res->second.regs[4];
+            m_apsr            = res->second.apsr;
+            m_regfile[REG_PC] = lr & ~1;
+
+            // Account for the skipped instructions (incl. SysTick time)
+            m_inst_count += res->second.insts;
+            if (m_systick->clock(res->second.insts) != -1)
+                m_systick_irq = true;
+
+            it->hits++;
+        }
+        // Miss: profile this call
+        else
+        {
+            m_memo_func      = &(*it);
+            m_memo_key       = key;
+            m_memo_entry_sp  = m_regfile[REG_SP];
+            m_memo_ret_pc    = lr & ~1;
+            m_memo_start     = m_inst_count;
+            m_memo_pure      = true;
+            m_memo_profiling = true;
+        }
+        return ;
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_memo_load: Load performed whilst profiling
+//-----------------------------------------------------------------
+void Armv6m::armv6m_memo_load(uint32_t addr)
+{
+    // Own stack frame
+    if (addr < m_memo_entry_sp && addr >= m_regfile[REG_SP] - MEMO_PUSH_WINDOW)
+        return ;
+
+    if (armv6m_memo_is_mmio(addr))
+        m_memo_pure = false;
+    else
+        armv6m_memo_span(m_memo_func, addr);
+}
+//-----------------------------------------------------------------
+// armv6m_memo_store: Store to memory (profiling or not)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_memo_store(uint32_t addr)
+{
+    uint32_t lo = addr & ~3;
+    uint32_t hi = lo + 3;
+
+    // Discard results which depend on this address
+    for (std::vector<tMemoFunc>::iterator it = m_memo_funcs.begin(); it != m_memo_funcs.end(); ++it)
+        for (std::vector<tMemoSpan>::iterator sp = it->spans.begin(); sp != it->spans.end(); ++sp)
+            if (lo <= sp->hi && hi >= sp->lo)
+            {
+                it->results.clear();
+                it->spans.clear();
+                break;
+            }
+
+    // Stores outside own stack frame are side effects
+    if (m_memo_profiling)
+    {
+        if (!(addr < m_memo_entry_sp && addr >= m_regfile[REG_SP] - MEMO_PUSH_WINDOW))
+            m_memo_pure = false;
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_memo_span: Record an address read by a function
+//-----------------------------------------------------------------
+void Armv6m::armv6m_memo_span(tMemoFunc *func, uint32_t addr)
+{
+    uint32_t lo = addr & ~3;
+    uint32_t hi = lo + 3;
+
+    for (std::vector<tMemoSpan>::iterator sp = func->spans.begin(); sp != func->spans.end(); ++sp)
+        if (lo <= sp->hi + MEMO_SPAN_GAP && hi + MEMO_SPAN_GAP >= sp->lo)
+        {
+            if (lo < sp->lo) sp->lo = lo;
+            if (hi > sp->hi) sp->hi = hi;
+            return ;
+        }
+
+    // Too scattered to track
+    if (func->spans.size() >= MEMO_MAX_SPANS)
+    {
+        m_memo_pure = false;
+        return ;
+    }
+
+    tMemoSpan span;
+    span.lo = lo;
+    span.hi = hi;
+    func->spans.push_back(span);
+}
+//-----------------------------------------------------------------
+// armv6m_memo_is_mmio: Address is a device (or unmapped)
+//-----------------------------------------------------------------
+bool Armv6m::armv6m_memo_is_mmio(uint32_t addr)
+{
+    uint32_t offset;
+    Memory *mem = armv6m_lookup(addr, &offset);
+
+    return mem == NULL || mem->get_buffer() == NULL;
+}
+//-----------------------------------------------------------------
+// armv6m_memo_flush: Discard all memoised results (memory has been
+// replaced wholesale, e.g. by restoring a snapshot)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_memo_flush(void)
+{
+    m_memo_profiling = false;
+
+    for (std::vector<tMemoFunc>::iterator it = m_memo_funcs.begin(); it != m_memo_funcs.end(); ++it)
+    {
+        it->results.clear();
+        it->spans.clear();
+    }
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Memory protection unit
+//
+// The MPU configuration is compiled into per-page flags: for pages
+// where one region (or the background map) decides the permissions,
+// the denied accesses are recorded as PAGE_MPU_* flags, and the flags
+// for the current privilege level are added to the slow path flags.
+// Permitted accesses therefore keep the direct host access path, and
+// only pages which regions divide (PAGE_MPU_PARTIAL) are checked by
+// walking the regions for each access.
+//
+// A region change recompiles the pages it covered before and covers
+// now. Violations raise a HardFault (there is no MemManage fault on
+// ARMv6-M). The PPB (0xE0000000-0xE00FFFFF) is never checked.
+//-----------------------------------------------------------------
+#define MPU_MIN_SIZE_FIELD      7 // 256 bytes
+
+//-----------------------------------------------------------------
+// mpu_ap_allowed: Access permitted by region attributes
+//-----------------------------------------------------------------
+static bool mpu_ap_allowed(uint32_t rasr, bool priv, tAccess access)
+{
+    bool rd = false;
+    bool wr = false;
+
+    if (access == ACCESS_FETCH && (rasr & MPU_RASR_XN))
+        return false;
+
+    switch ((rasr >> MPU_RASR_AP_SHIFT) & MPU_RASR_AP_MASK)
+    {
+        case 1: // Privileged RW
+            rd = wr = priv;
+        break;
+        case 2: // Privileged RW, unprivileged RO
+            rd = true;
+            wr = priv;
+        break;
+        case 3: // Full access
+            rd = wr = true;
+        break;
+        case 5: // Privileged RO
+            rd = priv;
+        break;
+        case 6: // Read-only
+        case 7:
+            rd = true;
+        break;
+        default: // No access (4 is reserved)
+        break;
+    }
+
+    return (access == ACCESS_WRITE) ? wr : rd;
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_changed: MPU register written (region, or -1 for all)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_mpu_changed(void *arg, int region)
+{
+    Armv6m *cpu = (Armv6m *)arg;
+
+    if (cpu->m_mpu->get_ctrl() & MPU_CTRL_ENABLE)
+    {
+        // Pages the region covered before, then those it covers now
+        if (region >= 0)
+        {
+            cpu->armv6m_mpu_pages(cpu->m_mpu_base[region], cpu->m_mpu_end[region]);
+
+            if (!cpu->armv6m_mpu_extent(region, &cpu->m_mpu_base[region], &cpu->m_mpu_end[region]))
+                cpu->m_mpu_end[region] = cpu->m_mpu_base[region] = 0;
+
+            cpu->armv6m_mpu_pages(cpu->m_mpu_base[region], cpu->m_mpu_end[region]);
+        }
+        else
+        {
+            for (int r=0;r<MPU_REGIONS;r++)
+                if (!cpu->armv6m_mpu_extent(r, &cpu->m_mpu_base[r], &cpu->m_mpu_end[r]))
+                    cpu->m_mpu_end[r] = cpu->m_mpu_base[r] = 0;
+
+            cpu->armv6m_mpu_pages(0, 0x100000000ULL);
+        }
+    }
+
+    cpu->armv6m_mpu_update();
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_update: Slow path flags for the current privilege level
+// (called when the mode, CONTROL or MPU enable changes)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_mpu_update(void)
+{
+    bool enabled = m_mpu && (m_mpu->get_ctrl() & MPU_CTRL_ENABLE);
+
+    // HardFault handler runs with the MPU disabled unless HFNMIENA
+    if (enabled && m_current_mode == MODE_HANDLER && m_ipsr == EXC_HARDFAULT && !(m_mpu->get_ctrl() & MPU_CTRL_HFNMIENA))
+        enabled = false;
+
+    m_mpu_active = enabled;
+    m_slow_fetch = PAGE_SLOW_FETCH;
+    m_slow_read  = PAGE_SLOW_READ;
+    m_slow_write = PAGE_SLOW_WRITE;
+
+    if (!enabled)
+        return ;
+
+    bool priv = (m_current_mode == MODE_HANDLER) || !(m_control & CONTROL_NPRIV);
+
+    m_slow_fetch |= PAGE_MPU_PARTIAL | PAGE_MPU_NX | (priv ? PAGE_MPU_P_NR : PAGE_MPU_U_NR);
+    m_slow_read  |= PAGE_MPU_PARTIAL | (priv ? PAGE_MPU_P_NR : PAGE_MPU_U_NR);
+    m_slow_write |= PAGE_MPU_PARTIAL | (priv ? PAGE_MPU_P_NW : PAGE_MPU_U_NW);
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_extent: Address range of an enabled region
+//-----------------------------------------------------------------
+bool Armv6m::armv6m_mpu_extent(int region, uint32_t *base, uint64_t *end)
+{
+    uint32_t rasr = m_mpu->get_rasr(region);
+    if (!(rasr & MPU_RASR_ENABLE))
+        return false;
+
+    uint32_t size_field = (rasr >> MPU_RASR_SIZE_SHIFT) & MPU_RASR_SIZE_MASK;
+    if (size_field < MPU_MIN_SIZE_FIELD)
+        size_field = MPU_MIN_SIZE_FIELD;
+
+    uint64_t size = 1ULL << (size_field + 1);
+
+    *base = (uint32_t)(m_mpu->get_rbar(region) & ~(size - 1));
+    *end  = *base + size;
+    return true;
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_covers: Region's coverage of a page:
+// 0 = none, 1 = whole page, 2 = part of the page
+//-----------------------------------------------------------------
+int Armv6m::armv6m_mpu_covers(int region, uint32_t page_base)
+{
+    uint32_t base;
+    uint64_t end;
+
+    if (!armv6m_mpu_extent(region, &base, &end))
+        return 0;
+
+    uint64_t page_end = (uint64_t)page_base + PAGE_SIZE;
+    if (page_end <= base || page_base >= end)
+        return 0;
+
+    // Regions are aligned to their size, so a smaller one is inside
+    uint64_t size = end - base;
+    if (size < PAGE_SIZE)
+        return 2;
+
+    uint32_t srd = (m_mpu->get_rasr(region) >> MPU_RASR_SRD_SHIFT) & 0xFF;
+    uint64_t sub = size / 8;
+    int first    = (int)((page_base - base) / sub);
+
+    if (sub >= PAGE_SIZE)
+        return ((srd >> first) & 1) ? 0 : 1;
+
+    // Page spans several subregions
+    uint32_t mask = ((1 << (PAGE_SIZE / sub)) - 1) << first;
+    if (!(srd & mask))
+        return 1;
+    else if ((srd & mask) == mask)
+        return 0;
+
+    return 2;
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_pages: Compile MPU flags for mapped pages in base..end-1
+//-----------------------------------------------------------------
+void Armv6m::armv6m_mpu_pages(uint32_t base, uint64_t end)
+{
+    uint32_t ctrl = m_mpu->get_ctrl();
+
+    for (uint64_t addr = base & ~(uint64_t)PAGE_MASK; addr < end; addr += PAGE_SIZE)
+    {
+        // No pages in this part of the table
+        if (!m_page_table[addr >> PT_L1_SHIFT])
+        {
+            addr = ((addr >> PT_L1_SHIFT) << PT_L1_SHIFT) + (1ULL << PT_L1_SHIFT) - PAGE_SIZE;
+            continue;
+        }
+
+        tPage *page = armv6m_page((uint32_t)addr);
+        if (!page->mem && !(page->flags & PAGE_MIXED))
+            continue;
+
+        page->flags &= ~PAGE_MPU;
+
+        // PPB - not subject to the MPU
+        if ((addr >> 20) == 0xE00)
+            continue;
+
+        // Highest numbered region covering the page decides
+        int decide  = -1;
+        bool partial = false;
+        for (int r=MPU_REGIONS-1;r>=0 && decide < 0 && !partial;r--)
+        {
+            int cover = armv6m_mpu_covers(r, (uint32_t)addr);
+            if (cover == 1)
+                decide = r;
+            else if (cover == 2)
+                partial = true;
+        }
+
+        if (partial)
+            page->flags |= PAGE_MPU_PARTIAL;
+        // Region
+        else if (decide >= 0)
+        {
+            uint32_t rasr = m_mpu->get_rasr(decide);
+
+            if (rasr & MPU_RASR_XN)                              page->flags |= PAGE_MPU_NX;
+            if (!mpu_ap_allowed(rasr, true,  ACCESS_READ))       page->flags |= PAGE_MPU_P_NR;
+            if (!mpu_ap_allowed(rasr, true,  ACCESS_WRITE))      page->flags |= PAGE_MPU_P_NW;
+            if (!mpu_ap_allowed(rasr, false, ACCESS_READ))       page->flags |= PAGE_MPU_U_NR;
+            if (!mpu_ap_allowed(rasr, false, ACCESS_WRITE))      page->flags |= PAGE_MPU_U_NW;
+        }
+        // Background: privileged only (PRIVDEFENA)
+        else
+        {
+            page->flags |= PAGE_MPU_U_NR | PAGE_MPU_U_NW;
+            if (!(ctrl & MPU_CTRL_PRIVDEFENA))
+                page->flags |= PAGE_MPU_P_NR | PAGE_MPU_P_NW;
+        }
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_allowed: Access permitted (region walk)
+//-----------------------------------------------------------------
+bool Armv6m::armv6m_mpu_allowed(uint32_t address, bool priv, tAccess access)
+{
+    // PPB - not subject to the MPU
+    if ((address >> 20) == 0xE00)
+        return true;
+
+    for (int r=MPU_REGIONS-1;r>=0;r--)
+    {
+        uint32_t base;
+        uint64_t end;
+
+        if (!armv6m_mpu_extent(r, &base, &end) || address < base || address >= end)
+            continue;
+
+        uint32_t rasr = m_mpu->get_rasr(r);
+        uint64_t sub  = (end - base) / 8;
+
+        // Disabled subregion
+        if ((rasr >> (MPU_RASR_SRD_SHIFT + (address - base) / sub)) & 1)
+            continue;
+
+        return mpu_ap_allowed(rasr, priv, access);
+    }
+
+    return priv && (m_mpu->get_ctrl() & MPU_CTRL_PRIVDEFENA);
+}
+//-----------------------------------------------------------------
+// armv6m_mpu_check: Access on the slow path with the MPU enabled.
+// Raises a HardFault and returns false if not permitted.
+//-----------------------------------------------------------------
+bool Armv6m::armv6m_mpu_check(uint32_t address, tAccess access)
+{
+    static const char *names[] = { "Read", "Write", "Fetch" };
+
+    bool priv   = (m_current_mode == MODE_HANDLER) || !(m_control & CONTROL_NPRIV);
+    tPage *page = armv6m_page(address);
+    bool ok;
+
+    if (page && !(page->flags & PAGE_MPU_PARTIAL))
+    {
+        uint32_t deny;
+
+        if (access == ACCESS_WRITE)
+            deny = priv ? PAGE_MPU_P_NW : PAGE_MPU_U_NW;
+        else
+            deny = priv ? PAGE_MPU_P_NR : PAGE_MPU_U_NR;
+
+        if (access == ACCESS_FETCH)
+            deny |= PAGE_MPU_NX;
+
+        ok = !(page->flags & deny);
+    }
+    else
+        ok = armv6m_mpu_allowed(address, priv, access);
+
+    if (!ok)
+        error(false, "MPU: %s fault @ 0x%08x\n", names[access], address);
+
+    return ok;
+}
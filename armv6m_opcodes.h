@@ -10,6 +10,9 @@
 #define INST_IGRP6          6
 #define INST_IGRP7          7
 #define INST_IGRP8          8
+#define INST_IGRP9          9
+#define INST_IGRP10         10
+#define INST_UNDEFINED      15
 
 #define INST_IGRP0_MASK     0xF000
 #define INST_IGRP1_MASK     0xF800
@@ -20,6 +23,8 @@
 #define INST_IGRP6_MASK     0xFFE0
 #define INST_IGRP7_MASK     0xFFF0
 #define INST_IGRP8_MASK     0xFFFF
+#define INST_IGRP9_MASK     0xFD00
+#define INST_IGRP10_MASK    0xFBF0
 
 #define INST_ADCS_MASK      0xFFC0
 #define INST_ADDS_MASK      0xFE00
@@ -37,8 +42,11 @@
 #define INST_BICS_MASK      0xFFC0
 #define INST_BKPT_MASK      0xFF00
 #define INST_BL_MASK        0xF800
+#define INST_B_W_MASK       0xF800
 #define INST_BLX_MASK       0xFF80
 #define INST_BX_MASK        0xFF80
+#define INST_CBNZ_MASK      0xFD00
+#define INST_CBZ_MASK       0xFD00
 #define INST_CMN_MASK       0xFFC0
 #define INST_CMP_MASK       0xF800
 #define INST_CMP_1_MASK     0xFFC0
@@ -67,6 +75,8 @@
 #define INST_MOVS_MASK      0xF800
 #define INST_MOV_MASK       0xFF00
 #define INST_MOVS_1_MASK    0xFFC0
+#define INST_MOVT_MASK      0xFBF0
+#define INST_MOVW_MASK      0xFBF0
 #define INST_MRS_MASK       0xFFE0
 #define INST_MSR_MASK       0xFFE0
 #define INST_MULS_MASK      0xFFC0
@@ -81,6 +91,7 @@
 #define INST_RORS_MASK      0xFFC0
 #define INST_RSBS_MASK      0xFFC0
 #define INST_SBCS_MASK      0xFFC0
+#define INST_SDIV_MASK      0xFFF0
 #define INST_SEV_MASK       0xFFFF
 #define INST_STM_MASK       0xF800
 #define INST_STR_MASK       0xF800
@@ -100,6 +111,7 @@
 #define INST_TST_MASK       0xFFC0
 #define INST_UDF_MASK       0xFF00
 #define INST_UDF_W_MASK     0xFFF0
+#define INST_UDIV_MASK      0xFFF0
 #define INST_UXTB_MASK      0xFFC0
 #define INST_UXTH_MASK      0xFFC0
 #define INST_WFE_MASK       0xFFFF
@@ -124,8 +136,11 @@
 #define INST_BICS_OPCODE        0x4380
 #define INST_BKPT_OPCODE        0xBE00
 #define INST_BL_OPCODE          0xF000
+#define INST_B_W_OPCODE         0xF000
 #define INST_BLX_OPCODE         0x4780
 #define INST_BX_OPCODE          0x4700
+#define INST_CBNZ_OPCODE        0xB900
+#define INST_CBZ_OPCODE         0xB100
 #define INST_CMN_OPCODE         0x42C0
 #define INST_CMP_OPCODE         0x2800
 #define INST_CMP_1_OPCODE       0x4280
@@ -154,6 +169,8 @@
 #define INST_MOVS_OPCODE        0x2000
 #define INST_MOV_OPCODE         0x4600
 #define INST_MOVS_1_OPCODE      0x0000
+#define INST_MOVT_OPCODE        0xF2C0
+#define INST_MOVW_OPCODE        0xF240
 #define INST_MRS_OPCODE         0xF3E0
 #define INST_MSR_OPCODE         0xF380
 #define INST_MULS_OPCODE        0x4340
@@ -168,6 +185,7 @@
 #define INST_RORS_OPCODE        0x41C0
 #define INST_RSBS_OPCODE        0x4240
 #define INST_SBCS_OPCODE        0x4180
+#define INST_SDIV_OPCODE        0xFB90
 #define INST_SEV_OPCODE         0xBF40
 #define INST_STM_OPCODE         0xC000
 #define INST_STR_OPCODE         0x6000
@@ -187,6 +205,7 @@
 #define INST_TST_OPCODE         0x4200
 #define INST_UDF_OPCODE         0xDE00
 #define INST_UDF_W_OPCODE       0xF7F0
+#define INST_UDIV_OPCODE        0xFBB0
 #define INST_UXTB_OPCODE        0xB2C0
 #define INST_UXTH_OPCODE        0xB280
 #define INST_WFE_OPCODE         0xBF20
@@ -219,8 +238,11 @@ static struct cm0_inst instr_details[] =
 { INST_BICS_OPCODE, INST_BICS_MASK, "BICS <Rdn>,<Rm>" },
 { INST_BKPT_OPCODE, INST_BKPT_MASK, "BKPT #<imm8>" },
 { INST_BL_OPCODE, INST_BL_MASK, "BL <label>" },
+{ INST_B_W_OPCODE, INST_B_W_MASK, "B.W <label>" },
 { INST_BLX_OPCODE, INST_BLX_MASK, "BLX <Rm>" },
 { INST_BX_OPCODE, INST_BX_MASK, "BX <Rm>" },
+{ INST_CBNZ_OPCODE, INST_CBNZ_MASK, "CBNZ <Rn>,<label>" },
+{ INST_CBZ_OPCODE, INST_CBZ_MASK, "CBZ <Rn>,<label>" },
 { INST_CMN_OPCODE, INST_CMN_MASK, "CMN <Rn>,<Rm>" },
 { INST_CMP_OPCODE, INST_CMP_MASK, "CMP <Rn>,#<imm8>" },
 { INST_CMP_1_OPCODE, INST_CMP_1_MASK, "CMP <Rn>,<Rm> <Rn> and <Rm> both from R0-R7" },
@@ -248,6 +270,8 @@ static struct cm0_inst instr_details[] =
 { INST_MOVS_OPCODE, INST_MOVS_MASK, "MOVS <Rd>,#<imm8>" },
 { INST_MOV_OPCODE, INST_MOV_MASK, "MOV <Rd>,<Rm> Otherwise all versions of the Thumb instruction set." },
 { INST_MOVS_1_OPCODE, INST_MOVS_1_MASK, "MOVS <Rd>,<Rm>" },
+{ INST_MOVT_OPCODE, INST_MOVT_MASK, "MOVT <Rd>,#<imm16>" },
+{ INST_MOVW_OPCODE, INST_MOVW_MASK, "MOVW <Rd>,#<imm16>" },
 { INST_MRS_OPCODE, INST_MRS_MASK, "MRS <Rd>,<spec_reg>" },
 { INST_MSR_OPCODE, INST_MSR_MASK, "MSR <spec_reg>,<Rn>" },
 { INST_MULS_OPCODE, INST_MULS_MASK, "MULS <Rdm>,<Rn>,<Rdm>" },
@@ -262,6 +286,7 @@ static struct cm0_inst instr_details[] =
 { INST_RORS_OPCODE, INST_RORS_MASK, "RORS <Rdn>,<Rm>" },
 { INST_RSBS_OPCODE, INST_RSBS_MASK, "RSBS <Rd>,<Rn>,#0" },
 { INST_SBCS_OPCODE, INST_SBCS_MASK, "SBCS <Rdn>,<Rm>" },
+{ INST_SDIV_OPCODE, INST_SDIV_MASK, "SDIV <Rd>,<Rn>,<Rm>" },
 { INST_SEV_OPCODE, INST_SEV_MASK, "SEV" },
 { INST_STM_OPCODE, INST_STM_MASK, "STM <Rn>!,<registers>" },
 { INST_STR_OPCODE, INST_STR_MASK, "STR <Rt>, [<Rn>{,#<imm5>}]" },
@@ -281,6 +306,7 @@ static struct cm0_inst instr_details[] =
 { INST_TST_OPCODE, INST_TST_MASK, "TST <Rn>,<Rm>" },
 { INST_UDF_OPCODE, INST_UDF_MASK, "UDF #<imm8>" },
 { INST_UDF_W_OPCODE, INST_UDF_W_MASK, "UDF_W #<imm16>" },
+{ INST_UDIV_OPCODE, INST_UDIV_MASK, "UDIV <Rd>,<Rn>,<Rm>" },
 { INST_UXTB_OPCODE, INST_UXTB_MASK, "UXTB <Rd>,<Rm>" },
 { INST_UXTH_OPCODE, INST_UXTH_MASK, "UXTH <Rd>,<Rm>" },
 { INST_WFE_OPCODE, INST_WFE_MASK, "WFE" },
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Snapshots of machine state
+//
+// Taking a snapshot copies the CPU and device state and marks every
+// mapped page copy-on-write (PAGE_COW). The first store to such a page
+// saves its contents into each live snapshot which does not yet hold
+// it, then clears the flag so later stores take the fast path again.
+// A page without PAGE_COW is therefore held by every live snapshot.
+// Restoring copies back only the pages written since the snapshot.
+//-----------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// snapshot: Capture machine state
+//-----------------------------------------------------------------
+tSnapshot *Armv6m::snapshot(void)
+{
+    tSnapshot *snap = new tSnapshot;
+
+    armv6m_save_cpu(&snap->cpu);
+    armv6m_save_devices(snap->devices);
+
+    // Memory: all pages copy-on-write from now on
+    m_snapshots.push_back(snap);
+    armv6m_page_flags(PAGE_COW, true);
+
+    return snap;
+}
+//-----------------------------------------------------------------
+// restore: Return machine to the state captured by a snapshot.
+// The snapshot remains valid and can be restored again.
+//-----------------------------------------------------------------
+void Armv6m::restore(tSnapshot *snap)
+{
+    // Memory: pages written since the snapshot
+    for (std::map<uint32_t, uint8_t *>::iterator it = snap->pages.begin(); it != snap->pages.end(); ++it)
+    {
+        // Other snapshots may not yet hold this page
+        armv6m_page_modify(it->first);
+        armv6m_page_copy(it->first, it->second, true);
+    }
+
+    armv6m_restore_devices(snap->devices);
+    armv6m_restore_cpu(&snap->cpu);
+
+    // Memoised results may depend on memory which has been restored
+    armv6m_memo_flush();
+}
+//-----------------------------------------------------------------
+// snapshot_free: Release a snapshot
+//-----------------------------------------------------------------
+void Armv6m::snapshot_free(tSnapshot *snap)
+{
+    for (std::vector<tSnapshot *>::iterator it = m_snapshots.begin(); it != m_snapshots.end(); ++it)
+        if (*it == snap)
+        {
+            m_snapshots.erase(it);
+            break;
+        }
+
+    for (std::map<uint32_t, uint8_t *>::iterator it = snap->pages.begin(); it != snap->pages.end(); ++it)
+        delete [] it->second;
+
+    delete snap;
+
+    // Nothing left to save pages for
+    if (m_snapshots.empty())
+        armv6m_page_flags(PAGE_COW, false);
+}
+//-----------------------------------------------------------------
+// armv6m_save_cpu: Capture CPU state
+//-----------------------------------------------------------------
+void Armv6m::armv6m_save_cpu(tCpuState *cpu)
+{
+    for (int i=0;i<REGISTERS;i++)
+        cpu->regfile[i] = m_regfile[i];
+
+    cpu->psp           = m_psp;
+    cpu->msp           = m_msp;
+    cpu->apsr          = m_apsr;
+    cpu->ipsr          = m_ipsr;
+    cpu->epsr          = m_epsr;
+    cpu->primask       = m_primask;
+    cpu->control       = m_control;
+    cpu->current_mode  = m_current_mode;
+    cpu->entry_point   = m_entry_point;
+    cpu->fault         = m_fault;
+    cpu->fault_pending = m_fault_pending;
+    cpu->stop_reason   = m_stop_reason;
+    cpu->exit_code     = m_exit_code;
+    cpu->systick_irq   = m_systick_irq;
+    cpu->inst_count    = m_inst_count;
+}
+//-----------------------------------------------------------------
+// armv6m_restore_cpu: Restore CPU state
+//-----------------------------------------------------------------
+void Armv6m::armv6m_restore_cpu(const tCpuState *cpu)
+{
+    for (int i=0;i<REGISTERS;i++)
+        m_regfile[i] = cpu->regfile[i];
+
+    m_psp           = cpu->psp;
+    m_msp           = cpu->msp;
+    m_apsr          = cpu->apsr;
+    m_ipsr          = cpu->ipsr;
+    m_epsr          = cpu->epsr;
+    m_primask       = cpu->primask;
+    m_control       = cpu->control;
+    m_current_mode  = cpu->current_mode;
+    m_entry_point   = cpu->entry_point;
+    m_fault         = cpu->fault;
+    m_fault_pending = cpu->fault_pending;
+    m_stop_reason   = cpu->stop_reason;
+    m_exit_code     = cpu->exit_code;
+    m_systick_irq   = cpu->systick_irq;
+    m_inst_count    = cpu->inst_count;
+    m_break         = false;
+
+    armv6m_mpu_update();
+}
+//-----------------------------------------------------------------
+// armv6m_save_devices: Capture device state (by region base)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_save_devices(std::map <uint32_t, std::vector <uint32_t> > &devices)
+{
+    devices.clear();
+
+    for (std::vector<tMemRegion>::iterator it = m_regions.begin(); it != m_regions.end(); ++it)
+    {
+        uint32_t state[MAX_DEVICE_STATE];
+        int len = it->mem->save_state(state, MAX_DEVICE_STATE);
+        if (len > 0)
+            devices[it->base].assign(state, state + len);
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_restore_devices: Restore device state (by region base)
+//-----------------------------------------------------------------
+void Armv6m::armv6m_restore_devices(const std::map <uint32_t, std::vector <uint32_t> > &devices)
+{
+    for (std::map<uint32_t, std::vector <uint32_t> >::const_iterator it = devices.begin(); it != devices.end(); ++it)
+    {
+        int idx = armv6m_find_region(it->first);
+
+        if (idx >= 0 && m_regions[idx].base == it->first && !it->second.empty())
+            m_regions[idx].mem->restore_state(&it->second[0], it->second.size());
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_snapshot_page: Save a page to all snapshots before it is
+// first written.
+//-----------------------------------------------------------------
+void Armv6m::armv6m_snapshot_page(uint32_t address)
+{
+    tPage *page = armv6m_page(address);
+    if (!page || !(page->flags & PAGE_COW))
+        return ;
+
+    page->flags &= ~PAGE_COW;
+
+    uint32_t addr = address & ~PAGE_MASK;
+    for (std::vector<tSnapshot *>::iterator it = m_snapshots.begin(); it != m_snapshots.end(); ++it)
+    {
+        if ((*it)->pages.find(addr) != (*it)->pages.end())
+            continue;
+
+        uint8_t *buf = new uint8_t[PAGE_SIZE];
+        armv6m_page_copy(addr, buf, false);
+        (*it)->pages[addr] = buf;
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_page_copy: Copy a page of plain memory to / from a buffer
+//-----------------------------------------------------------------
+void Armv6m::armv6m_page_copy(uint32_t page, uint8_t *buf, bool to_mem)
+{
+    uint64_t lo = page;
+    uint64_t hi = lo + PAGE_SIZE;
+
+    if (!to_mem)
+        memset(buf, 0, PAGE_SIZE);
+
+    int idx = armv6m_find_region(page);
+    if (idx < 0)
+        idx = 0;
+
+    for (int j=idx;j<(int)m_regions.size() && m_regions[j].base < hi;j++)
+    {
+        uint8_t *host = m_regions[j].mem->get_buffer();
+        uint64_t base = m_regions[j].base;
+        uint64_t end  = base + m_regions[j].size;
+
+        // Devices and read-only memory (never changes)
+        if (!host || m_regions[j].mem->read_only() || end <= lo)
+            continue;
+
+        uint64_t start = base > lo ? base : lo;
+        uint64_t stop  = end < hi ? end : hi;
+
+        if (to_mem)
+            memcpy(host + (start - base), buf + (start - lo), stop - start);
+        else
+            memcpy(buf + (start - lo), host + (start - base), stop - start);
+    }
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "armv6m.h"
+
+//-----------------------------------------------------------------
+// Data watchpoints
+//
+// Pages holding any part of a watchpoint are flagged PAGE_WATCH_R /
+// PAGE_WATCH_W, which sends loads / stores to them down the slow path.
+// Only those accesses are compared against the watched ranges, so
+// accesses to other pages run at full speed. Instruction fetches and
+// debugger (block) accesses never trigger watchpoints.
+//
+// A hit lets the access complete, then stops execution in the same way
+// as a breakpoint (get_break), with the details in get_watch_hit.
+// Accesses which fault (or are dropped) are not reported.
+//-----------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// set_watchpoint: Watch reads / writes / both to addr..addr+len-1
+//-----------------------------------------------------------------
+bool Armv6m::set_watchpoint(uint32_t addr, uint32_t len, tWatchType type)
+{
+    if (len == 0 || ((uint64_t)addr + len) > 0x100000000ULL)
+        return false;
+
+    tWatchpoint wp;
+    wp.addr = addr;
+    wp.len  = len;
+    wp.type = type;
+
+    m_watchpoints.push_back(wp);
+    armv6m_watch_pages();
+    return true;
+}
+//-----------------------------------------------------------------
+// clr_watchpoint: Remove a watchpoint added with the same arguments
+//-----------------------------------------------------------------
+bool Armv6m::clr_watchpoint(uint32_t addr, uint32_t len, tWatchType type)
+{
+    for (std::vector<tWatchpoint>::iterator it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it)
+        if (it->addr == addr && it->len == len && it->type == type)
+        {
+            m_watchpoints.erase(it);
+            armv6m_watch_pages();
+            return true;
+        }
+
+    return false;
+}
+//-----------------------------------------------------------------
+// get_watch_hit: Details of the watchpoint which caused the last
+// break (and clear). Returns false if it was not a watchpoint.
+//-----------------------------------------------------------------
+bool Armv6m::get_watch_hit(tWatchHit *hit)
+{
+    if (!m_watch_hit_valid)
+        return false;
+
+    *hit = m_watch_hit;
+    m_watch_hit_valid = false;
+    return true;
+}
+//-----------------------------------------------------------------
+// armv6m_watch_pages: Rebuild the page watch flags
+//-----------------------------------------------------------------
+void Armv6m::armv6m_watch_pages(void)
+{
+    armv6m_page_flags(PAGE_WATCH_R | PAGE_WATCH_W, false);
+
+    for (std::vector<tWatchpoint>::iterator it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it)
+    {
+        uint32_t flags = 0;
+        if (it->type & WATCH_READ)
+            flags |= PAGE_WATCH_R;
+        if (it->type & WATCH_WRITE)
+            flags |= PAGE_WATCH_W;
+
+        uint64_t end = (uint64_t)it->addr + it->len;
+        for (uint64_t addr = it->addr & ~(uint64_t)PAGE_MASK; addr < end; addr += PAGE_SIZE)
+        {
+            // Unmapped pages fault anyway
+            tPage *page = armv6m_page((uint32_t)addr);
+            if (page)
+                page->flags |= flags;
+        }
+    }
+}
+//-----------------------------------------------------------------
+// armv6m_watch_check: Access to a page which may be watched
+//-----------------------------------------------------------------
+void Armv6m::armv6m_watch_check(uint32_t address, int width, uint32_t value, tWatchType type)
+{
+    tPage *page = armv6m_page(address);
+    if (!page || !(page->flags & (type == WATCH_READ ? PAGE_WATCH_R : PAGE_WATCH_W)))
+        return ;
+
+    // Earlier hit not yet stopped on
+    if (m_break && m_watch_hit_valid)
+        return ;
+
+    for (std::vector<tWatchpoint>::iterator it = m_watchpoints.begin(); it != m_watchpoints.end(); ++it)
+    {
+        if (!(it->type & type))
+            continue;
+
+        if (address <= it->addr + (it->len - 1) && it->addr <= address + (width - 1))
+        {
+            m_watch_hit.pc    = m_regfile[REG_PC];
+            m_watch_hit.addr  = address;
+            m_watch_hit.value = value;
+            m_watch_hit.type  = type;
+            m_watch_hit_valid = true;
+            m_break           = true;
+            return ;
+        }
+    }
+}
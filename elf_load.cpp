@@ -4,90 +4,233 @@
 #include <unistd.h>
 #include <libelf.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <gelf.h>
 #include <bfd.h>
 
 #include "elf_load.h"
 
 //-----------------------------------------------------------------
-// elf_load
+// Types
 //-----------------------------------------------------------------
-int elf_load(const char *filename, cb_mem_create fn_create, cb_mem_load fn_load, void *arg, uint32_t *start_addr)
+struct tElfLoad
 {
-    int fd;
-    Elf * e;
-    Elf_Kind ek;
+    const char          *filename;
+    int                  fd;
+    struct stat          st;
+    Elf                 *e;
+    size_t               shstrndx;
+    cb_mem_create        fn_create;
+    cb_mem_load          fn_load;
+    cb_mem_create_rom    fn_create_rom;
+    cb_mem_map           fn_map;
+    void                *arg;
+};
+
+//-----------------------------------------------------------------
+// elf_read: Read file contents into a new buffer (NULL on failure)
+//-----------------------------------------------------------------
+static uint8_t *elf_read(tElfLoad *ld, uint32_t offset, uint32_t size)
+{
+    uint8_t *buf = (uint8_t *)malloc(size);
+    if (buf && pread(ld->fd, buf, size, offset) != (ssize_t)size)
+    {
+        free(buf);
+        buf = NULL;
+    }
+
+    return buf;
+}
+//-----------------------------------------------------------------
+// elf_load_segment: Create / load a PT_LOAD segment (at its virtual
+// address). Memory beyond p_filesz is not written (new regions read
+// as zero).
+//-----------------------------------------------------------------
+static int elf_load_segment(tElfLoad *ld, Elf32_Phdr *phdr)
+{
+    uint32_t base   = phdr->p_vaddr;
+    uint32_t filesz = phdr->p_filesz;
+    uint32_t memsz  = phdr->p_memsz;
+    char     names[256];
+    int      len = 0;
+
+    // Sections making up the segment
+    names[0] = 0;
     Elf_Scn *scn;
+    for (int idx = 0; (scn = elf_getscn(ld->e, idx)) != NULL; idx++)
+    {
+        Elf32_Shdr *shdr = elf32_getshdr(scn);
+        if ((shdr->sh_flags & SHF_ALLOC) && shdr->sh_size > 0 && shdr->sh_addr >= base && shdr->sh_addr - base < memsz &&
+            len < (int)sizeof(names))
+            len += snprintf(names + len, sizeof(names) - len, "%s%s", len ? " " : "", elf_strptr(ld->e, ld->shstrndx, shdr->sh_name));
+    }
+
+    printf("Memory: 0x%x - 0x%x (Size=%dKB) [%s]\n", base, base + memsz - 1, memsz / 1024, names);
+
+    // Contents left in the file until touched (not read here)
+    bool     rom    = ld->fn_create_rom && !(phdr->p_flags & PF_W) && filesz == memsz;
+    uint32_t loaded = 0;
+    if (ld->fn_map && filesz > 0 && ld->fn_map(ld->arg, base, filesz, ld->filename, phdr->p_offset, rom))
+        loaded = filesz;
+
+    // Read-only contents (code / constants) - shared image
+    if (rom && !loaded)
+    {
+        uint8_t *data = elf_read(ld, phdr->p_offset, filesz);
+
+        char key[512];
+        snprintf(key, sizeof(key), "%s:%lx:%lx:%x:%x", ld->filename, (long)ld->st.st_ino, (long)ld->st.st_mtime, base, memsz);
+
+        int ok = data && ld->fn_create_rom(ld->arg, base, memsz, data, key);
+        free(data);
+
+        if (!ok)
+            fprintf(stderr, "ERROR: Cannot allocate memory region\n");
+        return ok;
+    }
+
+    if (memsz > loaded && !ld->fn_create(ld->arg, base + loaded, memsz - loaded))
+    {
+        fprintf(stderr, "ERROR: Cannot allocate memory region\n");
+        return 0;
+    }
+
+    // One copy for the whole segment
+    if (loaded < filesz)
+    {
+        uint8_t *data = elf_read(ld, phdr->p_offset, filesz);
+        int ok = data && ld->fn_load(ld->arg, base, data, filesz);
+        free(data);
+
+        if (!ok)
+        {
+            fprintf(stderr, "ERROR: Cannot write segment to 0x%08x\n", base);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// elf_load_section: Create / load an allocated section (files without
+// program headers)
+//-----------------------------------------------------------------
+static int elf_load_section(tElfLoad *ld, Elf_Scn *scn, Elf32_Shdr *shdr)
+{
     Elf_Data *data;
-    Elf32_Shdr *shdr;
-    size_t shstrndx;
+    bool      rom = ld->fn_create_rom && !(shdr->sh_flags & SHF_WRITE) && shdr->sh_type == SHT_PROGBITS;
+
+    printf("Memory: 0x%x - 0x%x (Size=%dKB) [%s]\n", shdr->sh_addr, shdr->sh_addr + shdr->sh_size - 1, shdr->sh_size / 1024, elf_strptr(ld->e, ld->shstrndx, shdr->sh_name));
+
+    if (ld->fn_map && shdr->sh_type == SHT_PROGBITS && ld->fn_map(ld->arg, shdr->sh_addr, shdr->sh_size, ld->filename, shdr->sh_offset, rom))
+    {
+        // Contents left in the file until touched (not read here)
+    }
+    // Read-only contents (code / constants) - shared image
+    else if (rom)
+    {
+        data = elf_getdata(scn, NULL);
+
+        char key[512];
+        snprintf(key, sizeof(key), "%s:%lx:%lx:%x:%x", ld->filename, (long)ld->st.st_ino, (long)ld->st.st_mtime, shdr->sh_addr, shdr->sh_size);
+
+        if (!ld->fn_create_rom(ld->arg, shdr->sh_addr, shdr->sh_size, (uint8_t*)data->d_buf, key))
+        {
+            fprintf(stderr, "ERROR: Cannot allocate memory region\n");
+            return 0;
+        }
+    }
+    else if (!ld->fn_create(ld->arg, shdr->sh_addr, shdr->sh_size))
+    {
+        fprintf(stderr, "ERROR: Cannot allocate memory region\n");
+        return 0;
+    }
+    else if (shdr->sh_type == SHT_PROGBITS)
+    {                
+        data = elf_getdata(scn, NULL);
+        if (!ld->fn_load(ld->arg, shdr->sh_addr, (uint8_t*)data->d_buf, shdr->sh_size))
+        {
+            fprintf(stderr, "ERROR: Cannot write section to 0x%08x\n", shdr->sh_addr);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// elf_load: Create / load the program by PT_LOAD segment (or by
+// allocated section if there are no program headers). With fn_map,
+// contents are mapped from the file where possible rather than
+// copied, so they are only read if the program touches them.
+//-----------------------------------------------------------------
+int elf_load(const char *filename, cb_mem_create fn_create, cb_mem_load fn_load, void *arg, uint32_t *start_addr, cb_mem_create_rom fn_create_rom /*= NULL*/, cb_mem_map fn_map /*= NULL*/)
+{
+    tElfLoad ld;
+    Elf_Kind ek;
+    size_t phnum = 0;
+    int ok = 1;
+
+    ld.filename      = filename;
+    ld.fn_create     = fn_create;
+    ld.fn_load       = fn_load;
+    ld.fn_create_rom = fn_create_rom;
+    ld.fn_map        = fn_map;
+    ld.arg           = arg;
 
     if (elf_version ( EV_CURRENT ) == EV_NONE)
         return 0;
 
-    if ((fd = open ( filename , O_RDONLY , 0)) < 0)
+    if ((ld.fd = open ( filename , O_RDONLY , 0)) < 0)
         return 0;
 
-    if ((e = elf_begin ( fd , ELF_C_READ, NULL )) == NULL)
+    if (fstat(ld.fd, &ld.st) < 0 || (ld.e = elf_begin ( ld.fd , ELF_C_READ, NULL )) == NULL)
+    {
+        close (ld.fd);
         return 0;
+    }
     
-    ek = elf_kind ( e );
-    if (ek != ELF_K_ELF)
-        return 0;
+    ek = elf_kind ( ld.e );
 
     // Get section name header index
-    if (elf_getshdrstrndx(e, &shstrndx)!=0)
+    if (ek != ELF_K_ELF || elf_getshdrstrndx(ld.e, &ld.shstrndx)!=0 || elf_getphdrnum(ld.e, &phnum) != 0)
+    {
+        elf_end ( ld.e );
+        close (ld.fd);
         return 0;
+    }
 
     // Get entry point
     if (start_addr)
     {
         GElf_Ehdr _ehdr;
-        GElf_Ehdr *ehdr = gelf_getehdr(e, &_ehdr);
+        GElf_Ehdr *ehdr = gelf_getehdr(ld.e, &_ehdr);
         *start_addr = (uint32_t)ehdr->e_entry;
     }
 
-    int section_idx = 0;
-    while ((scn = elf_getscn(e, section_idx)) != NULL)
+    Elf32_Phdr *phdr = phnum ? elf32_getphdr(ld.e) : NULL;
+    if (phdr)
     {
-        shdr = elf32_getshdr(scn);
-
-        // Section which need allocating
-        if ((shdr->sh_flags & SHF_ALLOC) && (shdr->sh_size > 0))
+        for (size_t i=0;ok && i<phnum;i++)
+            if (phdr[i].p_type == PT_LOAD && phdr[i].p_memsz > 0)
+                ok = elf_load_segment(&ld, &phdr[i]);
+    }
+    else
+    {
+        Elf_Scn *scn;
+        for (int idx = 0; ok && (scn = elf_getscn(ld.e, idx)) != NULL; idx++)
         {
-            data = elf_getdata(scn, NULL);
-
-            printf("Memory: 0x%x - 0x%x (Size=%dKB) [%s]\n", shdr->sh_addr, shdr->sh_addr + shdr->sh_size - 1, shdr->sh_size / 1024, elf_strptr(e, shstrndx, shdr->sh_name));
-
-            if (!fn_create(arg, shdr->sh_addr, shdr->sh_size))
-            {
-                fprintf(stderr, "ERROR: Cannot allocate memory region\n");
-                close (fd);
-                return 0;
-            }
-
-            if (shdr->sh_type == SHT_PROGBITS)
-            {                
-                int i;
-                for (i=0;i<shdr->sh_size;i++)
-                {                    
-                    if (!fn_load(arg, shdr->sh_addr + i, ((uint8_t*)data->d_buf)[i]))
-                    {
-                        fprintf(stderr, "ERROR: Cannot write byte to 0x%08x\n", shdr->sh_addr + i);
-                        close (fd);
-                        return 0;
-                    }
-                }
-            }
-        }
+            Elf32_Shdr *shdr = elf32_getshdr(scn);
 
-        section_idx++;
-    }    
+            // Section which need allocating
+            if ((shdr->sh_flags & SHF_ALLOC) && (shdr->sh_size > 0))
+                ok = elf_load_section(&ld, scn, shdr);
+        }
+    }
 
-    elf_end ( e );
-    close ( fd );
+    elf_end ( ld.e );
+    close ( ld.fd );
     
-    return 1;
+    return ok;
 }
 //-----------------------------------------------------------------
 // elf_get_symbol
@@ -129,3 +272,51 @@ long elf_get_symbol(const char *filename, const char *symname)
     bfd_close(ibfd);
     return -1;
 }
+//-----------------------------------------------------------------
+// elf_get_sections: Enumerate allocated sections (as listed by
+// elf_load)
+//-----------------------------------------------------------------
+int elf_get_sections(const char *filename, cb_section fn_section, void *arg)
+{
+    int fd;
+    Elf * e;
+    Elf_Scn *scn;
+    Elf32_Shdr *shdr;
+    size_t shstrndx;
+
+    if (elf_version ( EV_CURRENT ) == EV_NONE)
+        return 0;
+
+    if ((fd = open ( filename , O_RDONLY , 0)) < 0)
+        return 0;
+
+    if ((e = elf_begin ( fd , ELF_C_READ, NULL )) == NULL || elf_kind ( e ) != ELF_K_ELF)
+    {
+        close (fd);
+        return 0;
+    }
+
+    // Get section name header index
+    if (elf_getshdrstrndx(e, &shstrndx)!=0)
+    {
+        elf_end ( e );
+        close (fd);
+        return 0;
+    }
+
+    int section_idx = 0;
+    while ((scn = elf_getscn(e, section_idx)) != NULL)
+    {
+        shdr = elf32_getshdr(scn);
+
+        if ((shdr->sh_flags & SHF_ALLOC) && (shdr->sh_size > 0))
+            fn_section(arg, shdr->sh_addr, shdr->sh_size, elf_strptr(e, shstrndx, shdr->sh_name));
+
+        section_idx++;
+    }
+
+    elf_end ( e );
+    close ( fd );
+
+    return 1;
+}
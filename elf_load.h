@@ -7,12 +7,25 @@
 // Types
 //-------------------------------------------------------------
 typedef int (*cb_mem_create)(void *arg, uint32_t base, uint32_t size);
-typedef int (*cb_mem_load)(void *arg, uint32_t addr, uint8_t data);
+typedef int (*cb_mem_load)(void *arg, uint32_t addr, const uint8_t *data, uint32_t len);
+
+// Optional: create read-only region with contents (key identifies the image)
+typedef int (*cb_mem_create_rom)(void *arg, uint32_t base, uint32_t size, const uint8_t *data, const char *key);
+
+// Optional: create region with contents read from the file (offset) as
+// pages are first touched (read_only: as a read-only image, only for
+// contents fn_create_rom would be given). Returning 0 falls back to
+// create + load (or fn_create_rom).
+typedef int (*cb_mem_map)(void *arg, uint32_t base, uint32_t size, const char *filename, uint32_t offset, int read_only);
+
+// Allocated section (name valid only for the duration of the call)
+typedef int (*cb_section)(void *arg, uint32_t base, uint32_t size, const char *name);
 
 //-------------------------------------------------------------
 // Functions
 //-------------------------------------------------------------
-int  elf_load(const char *filename, cb_mem_create fn_create, cb_mem_load fn_load, void *arg, uint32_t *start_addr);
+int  elf_load(const char *filename, cb_mem_create fn_create, cb_mem_load fn_load, void *arg, uint32_t *start_addr, cb_mem_create_rom fn_create_rom = NULL, cb_mem_map fn_map = NULL);
 long elf_get_symbol(const char *filename, const char *symname);
+int  elf_get_sections(const char *filename, cb_section fn_section, void *arg);
 
 #endif
\ No newline at end of file
@@ -372,8 +372,7 @@ int gdb_server::read_memory(char *text)
 
     DPRINTF(5, ("Reading %3d bytes from 0x%04x\n", length, addr));
 
-    for (uint32_t i=0;i<length;i++)
-        buf[i] = m_cpu->read(addr + i);
+    m_cpu->read_block(addr, buf, length);
 
     gdb_packet_start();
     for (i = 0; i < length; i++)
@@ -420,8 +419,7 @@ int gdb_server::write_memory(char *text)
 
     DPRINTF(5, ("Writing %3d bytes to 0x%04x\n", length, addr));
 
-    for (uint32_t i=0;i<buflen;i++)
-        m_cpu->write(addr + i, buf[i]);
+    m_cpu->write_block(addr, buf, buflen);
 
     return gdb_send("OK");
 }
@@ -446,7 +444,18 @@ int gdb_server::set_pc(char *buf)
 //-----------------------------------------------------------------
 int gdb_server::send_status(int status)
 {
-    return gdb_send("S05");
+    char msg[8];
+    sprintf(msg, "S%02x", status & 0xFF);
+    return gdb_send(msg);
+}
+//-----------------------------------------------------------------
+// send_exit:
+//-----------------------------------------------------------------
+int gdb_server::send_exit(int exit_code)
+{
+    char msg[8];
+    sprintf(msg, "W%02x", exit_code & 0xFF);
+    return gdb_send(msg);
 }
 //-----------------------------------------------------------------
 // run:
@@ -467,6 +476,12 @@ int gdb_server::run(char *buf, int instructions)
             break;
         }
 
+        if (m_cpu->get_stopped())
+        {
+            DPRINTF(5, ("CPU stopped\n"));
+            break;
+        }
+
         m_cpu->step();
 
         // GDB Interrupt
@@ -475,6 +490,25 @@ int gdb_server::run(char *buf, int instructions)
     }
 
     DPRINTF(5, ("Stopping\n"));
+
+    // Program exited
+    if (m_cpu->get_stop_reason() == STOP_EXIT)
+        return send_exit(m_cpu->get_exit_code());
+    // Lockup - report as SIGSEGV
+    else if (m_cpu->get_stop_reason() == STOP_FAULT)
+        return send_status(11);
+
+    // Watchpoint hit
+    tWatchHit hit;
+    if (m_cpu->get_watch_hit(&hit))
+    {
+        char msg[32];
+
+        m_cpu->get_break();
+        sprintf(msg, "T05%swatch:%08x;", hit.type == WATCH_READ ? "r" : "", hit.addr);
+        return gdb_send(msg);
+    }
+
     return send_status(5);
 }
 //-----------------------------------------------------------------
@@ -525,8 +559,9 @@ int gdb_server::set_breakpoint(int enable, char *buf)
         return gdb_send("E00");
     }
 
-    /* We only support breakpoints (not data watch points) */
-    if (*parts[0] != '0' && *parts[0] != '1')
+    /* Breakpoints (0/1) and data watch points (2 = write, 3 = read, 4 = access) */
+    type = atoi(parts[0]);
+    if (type < 0 || type > 4)
     {
         printf("gdb: unsupported breakpoint type: %s\n",
             parts[0]);
@@ -543,6 +578,18 @@ int gdb_server::set_breakpoint(int enable, char *buf)
     /* Parse the breakpoint address */
     addr = (uint32_t)atoui(parts[1]);
 
+    if (type >= 2)
+    {
+        static const tWatchType watch_types[] = { WATCH_WRITE, WATCH_READ, WATCH_ACCESS };
+        uint32_t len = parts[2] ? (uint32_t)atoui(parts[2]) : 1;
+
+        if (enable ? !m_cpu->set_watchpoint(addr, len, watch_types[type - 2]) :
+                     !m_cpu->clr_watchpoint(addr, len, watch_types[type - 2]))
+            return gdb_send("E00");
+
+        return gdb_send("OK");
+    }
+
     if (enable) 
     {
         if (!m_cpu->set_breakpoint(addr))
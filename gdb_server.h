@@ -38,6 +38,7 @@ protected:
     int read_register(char *buf);
 
     int send_status(int status);
+    int send_exit(int exit_code);
     int run(char *buf, int instructions);
     int single_step(char *buf);
 
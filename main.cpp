@@ -4,83 +4,303 @@
 #include <assert.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/stat.h>
 
 #include "armv6m.h"
+#include "armv6m_lanes.h"
 #include "elf_load.h"
 #include "gdb_server.h"
 
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define MAX_MEMO_FUNCS      16
+#define MAX_SECTIONS        64
+#define MAX_WATCHPOINTS     16
+
+//-----------------------------------------------------------------
+// Types
+//-----------------------------------------------------------------
+struct tSection
+{
+    uint32_t base;
+    uint32_t size;
+    char     name[32];
+};
+
+struct tSectionList
+{
+    tSection list[MAX_SECTIONS];
+    int      count;
+};
+
+struct tWatchArg
+{
+    char      *spec;    // 0xaddr[,len]
+    tWatchType type;
+};
+
 //-----------------------------------------------------------------
 // mem_create: Create memory region
 //-----------------------------------------------------------------
 static int mem_create(void *arg, uint32_t base, uint32_t size)
 {
     Armv6m *sim = (Armv6m *)arg;
+
+    // Already inside an existing region (e.g. sections in SRAM)
+    if (sim->valid_addr(base) && sim->valid_addr(base + size - 1))
+        return 1;
+
     return sim->create_memory(base, size);
 }
 //-----------------------------------------------------------------
-// mem_load: Load byte into memory
+// mem_create_rom: Create read-only (flash) region shared between
+// instances
+//-----------------------------------------------------------------
+static int mem_create_rom(void *arg, uint32_t base, uint32_t size, const uint8_t *data, const char *key)
+{
+    Armv6m *sim = (Armv6m *)arg;
+
+    // Already inside an existing (RAM) region - load as normal
+    if (sim->valid_addr(base) && sim->valid_addr(base + size - 1))
+        return sim->write_block(base, data, size);
+
+    return sim->create_rom(base, size, data, key);
+}
+//-----------------------------------------------------------------
+// mem_map: Create region with contents mapped from the ELF file
+// (copy-on-write or read-only, read in as pages are touched).
+// Pages not yet touched come from the file as it is when touched, so
+// rewriting the ELF (e.g. relinking it) during a run changes guest
+// code / data or faults the simulator (SIGBUS) - hence only with -P.
+//-----------------------------------------------------------------
+static int mem_map(void *arg, uint32_t base, uint32_t size, const char *filename, uint32_t offset, int read_only)
+{
+    Armv6m *sim = (Armv6m *)arg;
+
+    // Part of an existing region - copied in by mem_load
+    if (sim->valid_addr(base) || sim->valid_addr(base + size - 1))
+        return 0;
+
+    if (read_only)
+        return sim->map_rom(base, size, filename, offset);
+
+    return sim->map_memory(base, size, filename, false, offset);
+}
+//-----------------------------------------------------------------
+// mem_load: Load block into memory
 //-----------------------------------------------------------------
-static int mem_load(void *arg, uint32_t addr, uint8_t data)
+static int mem_load(void *arg, uint32_t addr, const uint8_t *data, uint32_t len)
 {
     Armv6m *sim = (Armv6m *)arg;
-    sim->write(addr, data);
-    return sim->valid_addr(addr);
+    return sim->write_block(addr, data, len);
 }
 //-----------------------------------------------------------------
-// bin_load: Binary load
+// bin_load: Binary load at mem_base (mapped from the file, copy-on-
+// write, with -P - else read into a new memory region)
 //-----------------------------------------------------------------
-static int bin_load(const char *filename, cb_mem_create fn_create, cb_mem_load fn_load, void *arg, uint32_t mem_base, uint32_t mem_size, uint32_t *p_start_addr)
+static int bin_load(const char *filename, Armv6m *sim, uint32_t mem_base, uint32_t mem_size, bool map, uint32_t *p_start_addr)
 {
-    // Load file
-    FILE *f = fopen(filename, "rb");
-    if (f)
+    if (map)
     {
-        long size;
-        char *buf;
-        int error = 1;
+        if (!sim->map_memory(mem_base, mem_size, filename, false))
+        {
+            fprintf (stderr,"Error: Could not map %s\n", filename);
+            return 0;
+        }
+    }
+    else
+    {
+        FILE *f = fopen(filename, "rb");
+        if (!f)
+            return 0;
 
         // Get size
         fseek(f, 0, SEEK_END);
-        size = ftell(f);
+        long size = ftell(f);
         rewind(f);
 
-        buf = (char*)malloc(size+1);
-        if (buf)
-        {
-            // Read file data in
-            int len = fread(buf, 1, size, f);
-            buf[len] = 0;
+        uint8_t *buf = (uint8_t *)malloc(size > 0 ? size : 1);
+        size_t   len = buf ? fread(buf, 1, size, f) : 0;
+        fclose(f);
 
-            if (!mem_create(arg, mem_base, mem_size))
-                fprintf (stderr,"Error: Could not allocate memory\n");
-            else
-            {
-                error = 0;
-                for (int i=0;i<len;i++)
-                {
-                    if (!mem_load(arg, mem_base + i, buf[i]))
-                    {
-                        fprintf (stderr,"Error: Could not load image to memory\n");
-                        error = 1;
-                        break;
-                    }
-                }
-            }
+        int ok = 0;
+        if (!buf)
+            fprintf (stderr,"Error: Could not allocate memory\n");
+        else if (!mem_create(sim, mem_base, mem_size))
+            fprintf (stderr,"Error: Could not allocate memory\n");
+        else if (!sim->write_block(mem_base, buf, len))
+            fprintf (stderr,"Error: Could not load image to memory\n");
+        else
+            ok = 1;
 
-            free(buf);
-            fclose(f);
+        free(buf);
+        if (!ok)
+            return 0;
+    }
+
+    if (p_start_addr)
+        *p_start_addr = mem_base;
+
+    return 1;
+}
+//-----------------------------------------------------------------
+// lane_create: Extra instance for -L, loaded the same way as the first
+//-----------------------------------------------------------------
+static Armv6m *lane_create(const char *filename, bool is_bin, bool v8m_base, bool explicit_mem,
+                           uint32_t mem_base, uint32_t mem_size, bool flash_ro, bool elf_map, uint32_t start_addr)
+{
+    Armv6m *sim = new Armv6m();
+
+    if (v8m_base)
+        sim->set_arch(ARCH_V8M_BASE);
+
+    if (explicit_mem && !is_bin)
+        mem_create(sim, mem_base, mem_size);
+
+    if ((is_bin && bin_load(filename, sim, mem_base, mem_size, elf_map, NULL)) ||
+        elf_load(filename, mem_create, mem_load, sim, NULL, flash_ro ? mem_create_rom : NULL,
+                 elf_map ? mem_map : NULL))
+    {
+        sim->reset(start_addr);
+        return sim;
+    }
+
+    delete sim;
+    return NULL;
+}
+//-----------------------------------------------------------------
+// lanes_run: Run the first instance and n-1 copies in lockstep
+// (optionally telling each its index), returning the first failing
+// exit code
+//-----------------------------------------------------------------
+static int lanes_run(const char *filename, bool is_bin, bool v8m_base, bool explicit_mem, uint32_t mem_base,
+                     uint32_t mem_size, bool flash_ro, bool elf_map, uint32_t start_addr, Armv6m *sim, int n,
+                     const uint32_t *lane_addr, int max_cycles)
+{
+    Armv6mLanes lanes;
+    int exitcode = 0;
+
+    lanes.add_lane(sim);
+    for (int i=1;i<n;i++)
+    {
+        Armv6m *lane = lane_create(filename, is_bin, v8m_base, explicit_mem, mem_base, mem_size, flash_ro, elf_map, start_addr);
+        if (!lane)
+        {
+            fprintf (stderr,"Error: Could not load lane %d\n", i);
+            break;
         }
+        lanes.add_lane(lane);
+    }
+
+    if (lane_addr)
+        for (int i=0;i<lanes.get_lanes();i++)
+            lanes.get_lane(i)->write32(*lane_addr, i);
+
+    lanes.run(max_cycles != -1 ? (uint64_t)max_cycles : ~(uint64_t)0);
 
-        if (p_start_addr)
-            *p_start_addr = mem_base;
+    for (int i=0;i<lanes.get_lanes();i++)
+    {
+        Armv6m *lane = lanes.get_lane(i);
 
-        return !error;
+        if (lane->get_stop_reason() == STOP_EXIT)
+        {
+            printf("Lane %d: Exit code = %d\n", i, lane->get_exit_code());
+            if (!exitcode)
+                exitcode = lane->get_exit_code();
+        }
+        else if (lane->get_fault())
+        {
+            printf("Lane %d: Fault\n", i);
+            if (!exitcode)
+                exitcode = 1;
+        }
+        else
+            printf("Lane %d: Stopped after %llu instructions\n", i, (unsigned long long)lane->get_inst_count());
+
+        if (lane != sim)
+            delete lane;
     }
+
+    printf("Lanes: %llu instructions in SIMD, %llu stepped individually\n",
+           (unsigned long long)lanes.get_vector_insts(), (unsigned long long)lanes.get_scalar_insts());
+    return exitcode;
+}
+//-----------------------------------------------------------------
+// image_key: Identity of the image file (path:inode:mtime) so that
+// checkpoints are only resumed against the image they were taken from
+//-----------------------------------------------------------------
+static void image_key(const char *filename, char *key, int len)
+{
+    struct stat st;
+
+    if (stat(filename, &st) == 0)
+        snprintf(key, len, "%s:%lx:%lx", filename, (long)st.st_ino, (long)st.st_mtime);
     else
-    {
-        fprintf (stderr,"Error: Could not open %s\n", filename);
+        snprintf(key, len, "%s", filename);
+}
+//-----------------------------------------------------------------
+// section_add: Record ELF section (heatmap annotation)
+//-----------------------------------------------------------------
+static int section_add(void *arg, uint32_t base, uint32_t size, const char *name)
+{
+    tSectionList *sections = (tSectionList *)arg;
+
+    if (sections->count >= MAX_SECTIONS)
+        return 0;
+
+    tSection *sec = &sections->list[sections->count++];
+    sec->base = base;
+    sec->size = size;
+    snprintf(sec->name, sizeof(sec->name), "%s", name ? name : "");
+    return 1;
+}
+//-----------------------------------------------------------------
+// heatmap_dump: Write per-page access counts as CSV, with the ELF
+// sections overlapping each page
+//-----------------------------------------------------------------
+static int heatmap_dump(const char *filename, Armv6m *sim, const char *elf)
+{
+    const tHeat *heat = sim->get_heatmap();
+    if (!heat)
         return 0;
+
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return 0;
+
+    tSectionList sections;
+    sections.count = 0;
+    if (elf)
+        elf_get_sections(elf, section_add, &sections);
+
+    fprintf(f, "page,reads,writes,fetches,sections\n");
+
+    for (uint32_t i=0;i<HEAT_PAGES;i++)
+    {
+        if (!heat[i].reads && !heat[i].writes && !heat[i].fetches)
+            continue;
+
+        uint32_t base = i << PAGE_SHIFT;
+
+        fprintf(f, "0x%08x,%llu,%llu,%llu,", base, (unsigned long long)heat[i].reads,
+                (unsigned long long)heat[i].writes, (unsigned long long)heat[i].fetches);
+
+        bool first = true;
+        for (int s=0;s<sections.count;s++)
+        {
+            tSection *sec = &sections.list[s];
+            if (sec->base <= base + PAGE_MASK && base <= sec->base + (sec->size - 1))
+            {
+                fprintf(f, "%s%s", first ? "" : " ", sec->name);
+                first = false;
+            }
+        }
+        fprintf(f, "\n");
     }
+
+    fclose(f);
+    return 1;
 }
 //-----------------------------------------------------------------
 // main
@@ -102,9 +322,31 @@ int main(int argc, char *argv[])
     bool explicit_mem = true;
     bool gdb = false;
     int  gdb_port = 3333;
+    bool v8m_base = false;
+    bool flash_ro = false;
+    bool elf_map = false;
+    char *checkpoint_file = NULL;
+    uint64_t checkpoint_interval = 0;
+    uint64_t checkpoint_last = 0;
+    FILE *checkpoint = NULL;
+    char checkpoint_key[512];
+    char *nvram_file = NULL;
+    uint32_t nvram_base = 0;
+    bool nvram_base_set = false;
+    char *heatmap_file = NULL;
+    char *shm_name = NULL;
+    char *core_file = NULL;
+    tWatchArg watches[MAX_WATCHPOINTS];
+    int  watch_count = 0;
+    char *memo_funcs[MAX_MEMO_FUNCS];
+    int  memo_count = 0;
+    int  lanes = 0;
+    uint32_t lane_addr = 0;
+    bool lane_addr_set = false;
+    int exitcode = 0;
     int c;
 
-    while ((c = getopt (argc, argv, "t:v:f:c:r:d:b:s:e:X:g")) != -1)
+    while ((c = getopt (argc, argv, "t:v:f:c:r:d:b:s:e:X:gmM:n:N:C:I:FPH:w:a:S:D:L:")) != -1)
     {
         switch(c)
         {
@@ -141,6 +383,60 @@ int main(int argc, char *argv[])
             case 'g':
                 gdb = true;
                 break;
+            case 'm':
+                v8m_base = true;
+                break;
+            case 'M':
+                if (memo_count < MAX_MEMO_FUNCS)
+                    memo_funcs[memo_count++] = optarg;
+                break;
+            case 'n':
+                nvram_file = optarg;
+                break;
+            case 'N':
+                nvram_base = strtoul(optarg, NULL, 0);
+                nvram_base_set = true;
+                break;
+            case 'F':
+                flash_ro = true;
+                break;
+            case 'P':
+                elf_map = true;
+                break;
+            case 'C':
+                checkpoint_file = optarg;
+                break;
+            case 'I':
+                checkpoint_interval = strtoull(optarg, NULL, 0);
+                break;
+            case 'H':
+                heatmap_file = optarg;
+                break;
+            case 'S':
+                shm_name = optarg;
+                break;
+            case 'D':
+                core_file = optarg;
+                break;
+            case 'w':
+            case 'a':
+                if (watch_count < MAX_WATCHPOINTS)
+                {
+                    watches[watch_count].spec   = optarg;
+                    watches[watch_count++].type = (c == 'w') ? WATCH_WRITE : WATCH_ACCESS;
+                }
+                break;
+            case 'L':
+            {
+                char *end;
+                lanes = (int)strtoul(optarg, &end, 0);
+                if (*end == ',')
+                {
+                    lane_addr     = strtoul(end + 1, NULL, 0);
+                    lane_addr_set = true;
+                }
+                break;
+            }
             case '?':
             default:
                 help = 1;   
@@ -148,7 +444,15 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (help || (filename == NULL))
+    // Lanes are run by Armv6mLanes, without the per-instance extras
+    if (lanes && (lanes < 1 || lanes > LANES_MAX || gdb || trace || trace_pc != 0xFFFFFFFF || stop_pc != 0xFFFFFFFF ||
+                  memo_count || nvram_file || checkpoint_file || heatmap_file || shm_name || core_file || watch_count))
+    {
+        fprintf (stderr,"Error: -L takes 1-%d lanes and cannot be combined with -g/-t/-e/-r/-M/-n/-C/-H/-S/-D/-w/-a\n", LANES_MAX);
+        help = 1;
+    }
+
+    if (help || (filename == NULL) || (nvram_file && !nvram_base_set))
     {
         fprintf (stderr,"Usage:\n");
         fprintf (stderr,"-f filename.[bin/elf] = Executable to load (binary or ELF)\n");
@@ -159,32 +463,67 @@ int main(int argc, char *argv[])
         fprintf (stderr,"-e 0xnnnn             = Trace from PC address\n");
         fprintf (stderr,"-b 0xnnnn             = Memory base address (for binary loads)\n");
         fprintf (stderr,"-s nnnn               = Memory size (for binary loads)\n");
+        fprintf (stderr,"-S name               = Share memory (-b/-s) with other processes as /dev/shm/name (must not exist)\n");
         fprintf (stderr,"-X 0xnnnn             = Override start address\n");
         fprintf (stderr,"-g                    = Start GDB server on port 3333\n");
+        fprintf (stderr,"-m                    = Enable ARMv8-M Baseline (Cortex-M23) instructions\n");
+        fprintf (stderr,"-M symbol/0xnnnn      = Memoise pure function (repeatable)\n");
+        fprintf (stderr,"-n filename           = NVRAM file (writes persist to the file)\n");
+        fprintf (stderr,"-N 0xnnnn             = NVRAM base address\n");
+        fprintf (stderr,"-F                    = Load read-only ELF sections as flash (writes fault)\n");
+        fprintf (stderr,"-P                    = Map ELF sections / binary images from the file instead of copying them\n");
+        fprintf (stderr,"                        (faster load; do not rebuild the ELF whilst running)\n");
+        fprintf (stderr,"-C filename           = Checkpoint file (resumed from if it exists)\n");
+        fprintf (stderr,"-I nnnn               = Checkpoint every nnnn instructions\n");
+        fprintf (stderr,"-H filename           = Write per-page access heatmap (CSV) on exit\n");
+        fprintf (stderr,"-w 0xnnnn[,len]       = Stop on write to address (repeatable)\n");
+        fprintf (stderr,"-a 0xnnnn[,len]       = Stop on read or write of address (repeatable)\n");
+        fprintf (stderr,"-D filename           = Write ELF core file if the run faults\n");
+        fprintf (stderr,"-L n[,0xnnnn]         = Run n copies in lockstep (SIMD), writing each copy's index to 0xnnnn\n");
         exit(-1);
     }
 
     Armv6m *sim = new Armv6m();
 
-    if (explicit_mem)
+    if (v8m_base)
+        sim->set_arch(ARCH_V8M_BASE);
+
+    char *ext = filename ? strrchr(filename, '.') : NULL;
+    bool is_bin = ext && !strcmp(ext, ".bin");
+
+    // Binary images are loaded at mem_base by bin_load
+    if (explicit_mem && !is_bin)
     {
         printf("MEM: Create memory 0x%08x-%08x\n", mem_base, mem_base + mem_size-1);
-        mem_create(sim, mem_base, mem_size);
+
+        if (!shm_name)
+            mem_create(sim, mem_base, mem_size);
+        else if (sim->create_shared_memory(mem_base, mem_size, shm_name))
+            printf("MEM: Shared as %s\n", shm_name);
+        else
+            fprintf (stderr,"Error: Could not create shared memory %s\n", shm_name);
     }
 
-    uint32_t start_addr = 0;
+    if (nvram_file)
+    {
+        if (sim->map_memory(nvram_base, 0, nvram_file, true))
+            printf("MEM: NVRAM 0x%08x [%s]\n", nvram_base, nvram_file);
+        else
+            fprintf (stderr,"Error: Could not map NVRAM %s\n", nvram_file);
+    }
 
-    char *ext = filename ? strrchr(filename, '.') : NULL;
+    uint32_t start_addr = 0;
 
     // Load ELF file
-    if ((ext && !strcmp(ext, ".bin") && bin_load(filename, mem_create, mem_load, NULL, mem_base, mem_size, &start_addr)) ||
-        elf_load(filename, mem_create, mem_load, sim, &start_addr))
+    if ((is_bin && bin_load(filename, sim, mem_base, mem_size, elf_map, &start_addr)) ||
+        elf_load(filename, mem_create, mem_load, sim, &start_addr, flash_ro ? mem_create_rom : NULL,
+                 elf_map ? mem_map : NULL))
     {
         // User specified start address
         if (explicit_start)
             start_addr = explicit_start_addr;
         // Find boot vectors if ELF file
-        else if (!(ext && !strcmp(ext, ".bin")))
+        else if (!is_bin)
             start_addr = elf_get_symbol(filename, "vectors");
 
         printf("Starting from 0x%08x\n", start_addr);
@@ -196,10 +535,81 @@ int main(int argc, char *argv[])
         if (trace)
             sim->enable_trace(trace_mask);
 
+        // Count accesses per page
+        if (heatmap_file && !sim->set_heatmap(true))
+            fprintf (stderr,"Error: Could not allocate heatmap\n");
+
+        // Pure functions to memoise
+        for (int i=0;i<memo_count;i++)
+        {
+            long addr;
+
+            if (memo_funcs[i][0] >= '0' && memo_funcs[i][0] <= '9')
+                addr = strtoul(memo_funcs[i], NULL, 0);
+            else
+                addr = elf_get_symbol(filename, memo_funcs[i]);
+
+            if (addr == -1)
+                fprintf (stderr,"Error: Could not find symbol %s\n", memo_funcs[i]);
+            else
+                sim->memo_add_function((uint32_t)addr);
+        }
+
+        // Data watchpoints
+        for (int i=0;i<watch_count;i++)
+        {
+            char *end;
+            uint32_t addr = strtoul(watches[i].spec, &end, 0);
+            uint32_t len  = (*end == ',') ? strtoul(end + 1, NULL, 0) : 4;
+
+            if (!sim->set_watchpoint(addr, len, watches[i].type))
+                fprintf (stderr,"Error: Bad watchpoint %s\n", watches[i].spec);
+        }
+
+        // Resume from / append to checkpoint file
+        if (checkpoint_file)
+        {
+            image_key(filename, checkpoint_key, sizeof(checkpoint_key));
+
+            checkpoint = fopen(checkpoint_file, "r+b");
+            if (!checkpoint)
+                checkpoint = fopen(checkpoint_file, "w+b");
+
+            if (!checkpoint)
+                fprintf (stderr,"Error: Could not open %s\n", checkpoint_file);
+            else
+            {
+                int records = sim->checkpoint_restore(checkpoint, checkpoint_key);
+                if (records < 0)
+                {
+                    fprintf (stderr,"Error: Bad checkpoint file %s\n", checkpoint_file);
+                    fclose(checkpoint);
+                    checkpoint = NULL;
+                }
+                else
+                {
+                    if (records > 0)
+                        printf("Resumed from %s at instruction %llu\n", checkpoint_file, (unsigned long long)sim->get_inst_count());
+
+                    // Drop any partial record and append from there
+                    if (ftruncate(fileno(checkpoint), ftell(checkpoint)) != 0)
+                        fprintf (stderr,"Error: Could not truncate %s\n", checkpoint_file);
+                    fseek(checkpoint, 0, SEEK_END);
+
+                    sim->set_dirty_tracking(true);
+                    checkpoint_last = sim->get_inst_count();
+                }
+            }
+        }
+
         _cycles = 0;
 
+        // Lockstep copies
+        if (lanes)
+            exitcode = lanes_run(filename, ext && !strcmp(ext, ".bin"), v8m_base, explicit_mem, mem_base, mem_size,
+                                 flash_ro, elf_map, start_addr, sim, lanes, lane_addr_set ? &lane_addr : NULL, max_cycles);
         // GDB server
-        if (gdb)
+        else if (gdb)
         {
             gdb_server *srv = new gdb_server(sim);
             srv->start(gdb_port);
@@ -212,11 +622,28 @@ int main(int argc, char *argv[])
             {
                 current_pc = sim->get_pc();
                 sim->step();
-                _cycles++;
+                _cycles = sim->get_inst_count();
+
+                // Watchpoint hit
+                tWatchHit hit;
+                if (watch_count && sim->get_break() && sim->get_watch_hit(&hit))
+                {
+                    printf("Watchpoint: %s 0x%08x = 0x%08x @ PC 0x%08x\n", hit.type == WATCH_READ ? "Read" : "Write",
+                           hit.addr, hit.value, hit.pc);
+                    break;
+                }
 
-                if (max_cycles != -1 && max_cycles == _cycles)
+                if (max_cycles != -1 && _cycles >= (unsigned)max_cycles)
                     break;
 
+                // Periodic checkpoint
+                if (checkpoint && checkpoint_interval && (sim->get_inst_count() - checkpoint_last) >= checkpoint_interval)
+                {
+                    if (!sim->checkpoint_save(checkpoint, checkpoint_key) || fsync(fileno(checkpoint)) != 0)
+                        fprintf (stderr,"Error: Could not write checkpoint\n");
+                    checkpoint_last = sim->get_inst_count();
+                }
+
                 // Turn trace on
                 if (trace_pc == current_pc)
                     sim->enable_trace(trace_mask);
@@ -226,9 +653,36 @@ int main(int argc, char *argv[])
     else
         fprintf (stderr,"Error: Could not open %s\n", filename);
 
-    // Fault occurred?
-    if (sim->get_fault())
-        return 1;
-    else
-        return 0;
+    if (heatmap_file && sim->get_heatmap() && !heatmap_dump(heatmap_file, sim, is_bin ? NULL : filename))
+        fprintf (stderr,"Error: Could not write heatmap %s\n", heatmap_file);
+
+    // Post-mortem core file
+    if (core_file && sim->get_fault())
+    {
+        FILE *f = fopen(core_file, "wb");
+        if (!f || !sim->core_dump(f))
+            fprintf (stderr,"Error: Could not write core file %s\n", core_file);
+        else
+            printf("Core written to %s\n", core_file);
+        if (f)
+            fclose(f);
+    }
+
+    // Lanes report their own exit
+    if (!lanes)
+    {
+        // Program exit (BKPT)
+        if (sim->get_stop_reason() == STOP_EXIT)
+        {
+            printf("Exit code = %d\n", sim->get_exit_code());
+            exitcode = sim->get_exit_code();
+        }
+        // Fault occurred?
+        else if (sim->get_fault())
+            exitcode = 1;
+    }
+
+    // Releases shared memory objects
+    delete sim;
+    return exitcode;
 }
@@ -2,6 +2,44 @@
 #define __MEMORY_H__
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits>
+#include <map>
+#include <string>
+#include <mutex>
+
+//--------------------------------------------------------------------
+// MMIO register handlers: called for 32-bit accesses to a bound
+// register, with the offset it was bound with. NULL read handlers
+// read as zero, NULL write handlers ignore writes. ctx is never NULL.
+//--------------------------------------------------------------------
+typedef uint32_t (*FP_MMIO_READ)(void *ctx, uint32_t offset);
+typedef void     (*FP_MMIO_WRITE)(void *ctx, uint32_t offset, uint32_t data);
+
+struct tMmioReg
+{
+    FP_MMIO_READ        read;
+    FP_MMIO_WRITE       write;
+    void               *ctx;
+    uint32_t            offset;
+};
+
+// Handlers which call member functions (ctx is the object)
+template <class C, uint32_t (C::*fn)(uint32_t)> uint32_t mmio_read(void *ctx, uint32_t offset)
+{
+    return (((C *)ctx)->*fn)(offset);
+}
+
+template <class C, void (C::*fn)(uint32_t, uint32_t)> void mmio_write(void *ctx, uint32_t offset, uint32_t data)
+{
+    (((C *)ctx)->*fn)(offset, data);
+}
 
 //--------------------------------------------------------------------
 // Abstract interface for memories / devices
@@ -9,6 +47,8 @@
 class Memory
 {
 public:
+    virtual             ~Memory() { }
+
     // Reset state
     virtual void        reset(void) = 0;
 
@@ -16,8 +56,37 @@ public:
     virtual uint32_t    load(uint32_t address, int width, bool signedLoad) = 0;
     virtual void        store(uint32_t address, uint32_t data, int width) = 0;
 
+    // Typed Load / Store: width from the type, signed types sign extend
+    template <typename T> T load(uint32_t address)
+    {
+        return (T)load(address, sizeof(T), std::numeric_limits<T>::is_signed);
+    }
+
+    template <typename T> void store(uint32_t address, T data)
+    {
+        store(address, (uint32_t)data, sizeof(T));
+    }
+
     // Clock: Return >= 0 if IRQ pending
     virtual int         clock(void) { return -1; }
+
+    // Device state for snapshots: returns number of words saved
+    virtual int         save_state(uint32_t *state, int max) { return 0; }
+    virtual void        restore_state(const uint32_t *state, int len) { }
+
+    // Backing store for plain memories which the CPU may access
+    // directly (little endian), or NULL if accesses have side effects
+    virtual uint8_t    *get_buffer(void) { return NULL; }
+
+    // Writes are not permitted (raise a fault)
+    virtual bool        read_only(void) { return false; }
+
+    // Only 32-bit accesses are supported (others raise a fault)
+    virtual bool        word_only(void) { return false; }
+
+    // Device register at offset for the CPU to dispatch to directly
+    // (32-bit accesses only). Returns false if it has none there.
+    virtual bool        mmio_reg(uint32_t offset, tMmioReg *reg) { return false; }
 };
 
 //--------------------------------------------------------------------
@@ -26,6 +95,8 @@ public:
 class Device: public Memory
 {
 public:
+    virtual bool word_only(void) { return true; }
+
     virtual uint32_t load(uint32_t address, int width, bool signedLoad)
     {
         assert(width == 4 || !"Unsupported access width");
@@ -50,6 +121,8 @@ class DummyDevice: public Memory
 public:
     DummyDevice(uint32_t base) { }
 
+    virtual bool word_only(void) { return true; }
+
     virtual uint32_t load(uint32_t address, int width, bool signedLoad)
     {
         assert(width == 4 || !"Unsupported access width");
@@ -66,28 +139,56 @@ public:
     void     write_reg(uint32_t address, uint32_t data) { }
     uint32_t read_reg(uint32_t address) { return 0; }
     int      clock(void) { return -1; }
+
+    // Every register: reads as zero, writes ignored
+    bool mmio_reg(uint32_t offset, tMmioReg *reg)
+    {
+        reg->read   = NULL;
+        reg->write  = NULL;
+        reg->ctx    = this;
+        reg->offset = offset;
+        return true;
+    }
 };
 
 //-----------------------------------------------------------------
 // Simple little endian memory
+// Owned storage is anonymous mmap, so pages are only allocated when
+// first written and untouched pages read as zero.
 //-----------------------------------------------------------------
 class SimpleMemory: public Memory
 {
 public:
     SimpleMemory(int size)
     {
-        Mem = new uint32_t[(size + 3)/4];
+        Mem = (uint32_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        Mapped = (Mem != MAP_FAILED);
+        if (!Mapped)
+            Mem = new uint32_t[(size + 3)/4];
+        Owned = true;
         Size = size;
     }
     SimpleMemory(uint8_t * buf, int size)
     {
         Mem = (uint32_t*)buf;
+        Mapped = false;
+        Owned = false;
         Size = size;
     }    
 
+    virtual ~SimpleMemory()
+    {
+        if (Mapped)
+            munmap(Mem, Size);
+        else if (Owned)
+            delete [] Mem;
+    }
+
     virtual void reset(void)
     {
-        memset(Mem, 0, Size);
+        // Drop pages back to (lazily allocated) zero pages
+        if (!Mapped || madvise(Mem, Size, MADV_DONTNEED) != 0)
+            memset(Mem, 0, Size);
     }
 
     virtual uint32_t load(uint32_t address, int width, bool signedLoad)
@@ -173,9 +274,366 @@ public:
         }
     }
 
+    virtual uint8_t *get_buffer(void) { return (uint8_t*)Mem; }
+
 private:
     uint32_t *Mem;
     int      Size;
+    bool     Mapped;
+    bool     Owned;
+};
+
+//-----------------------------------------------------------------
+// Memory held in a host buffer (Mem, Size bytes, little endian),
+// accessed in place. Derived classes set up and release the buffer
+// (Mem is NULL if that failed).
+//-----------------------------------------------------------------
+class BufferMemory: public Memory
+{
+public:
+    virtual uint32_t load(uint32_t address, int width, bool signedLoad)
+    {
+        uint32_t data = 0;
+
+        memcpy(&data, Mem + address, width);
+
+        if (signedLoad && width < 4 && (data & (1 << (width * 8 - 1))))
+            data |= 0xFFFFFFFF << (width * 8);
+
+        return data;
+    }
+
+    virtual void store(uint32_t address, uint32_t data, int width)
+    {
+        memcpy(Mem + address, &data, width);
+    }
+
+    virtual uint8_t *get_buffer(void) { return Mem; }
+
+protected:
+    uint8_t  *Mem;
+    uint32_t Size;
+};
+
+//-----------------------------------------------------------------
+// File backed memory (mmap).
+// Private mappings are copy-on-write (flash images - the file is never
+// modified), shared mappings write through to the file (NVRAM).
+// Pages are read from the file on first access. Any part of the
+// region beyond the end of a private file reads as zero.
+// The region can start part way into the file (offset, any alignment).
+//-----------------------------------------------------------------
+class MappedMemory: public BufferMemory
+{
+public:
+    // size = 0: size of the file (from offset)
+    MappedMemory(const char *filename, uint32_t size, bool shared, uint32_t offset = 0)
+    {
+        Mem   = NULL;
+        Size  = 0;
+        Delta = offset % sysconf(_SC_PAGESIZE);
+
+        int fd = open(filename, shared ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            return ;
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size > 0xFFFFFFFF)
+        {
+            close(fd);
+            return ;
+        }
+
+        // Mapped from the page holding the start of the region
+        uint32_t map_offset = offset - Delta;
+        uint32_t file_size  = (uint32_t)st.st_size > map_offset ? (uint32_t)st.st_size - map_offset : 0;
+        if (size == 0)
+            size = file_size > Delta ? file_size - Delta : 0;
+
+        // Shared: whole region is backed by the file
+        if (shared && file_size < Delta + size && ftruncate(fd, (off_t)map_offset + Delta + size) < 0)
+            size = 0;
+
+        if (size == 0)
+        {
+            close(fd);
+            return ;
+        }
+
+        uint8_t *map;
+        if (shared)
+            map = (uint8_t*)mmap(NULL, Delta + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset);
+        else
+        {
+            // Zero filled reservation, with the file mapped over the start
+            map = (uint8_t*)mmap(NULL, Delta + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map != MAP_FAILED && file_size > 0)
+            {
+                uint32_t len = file_size < Delta + size ? file_size : Delta + size;
+                if (mmap(map, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, map_offset) == MAP_FAILED)
+                {
+                    munmap(map, Delta + size);
+                    map = (uint8_t*)MAP_FAILED;
+                }
+            }
+        }
+
+        close(fd);
+
+        if (map != MAP_FAILED)
+        {
+            Mem  = map + Delta;
+            Size = size;
+        }
+    }
+
+    virtual ~MappedMemory()
+    {
+        if (Mem)
+            munmap(Mem - Delta, Delta + Size);
+    }
+
+    // Contents come from the file
+    virtual void reset(void) { }
+
+    uint32_t get_size(void) { return Size; }
+
+private:
+    uint32_t Delta; // Offset of Mem in the first mapped page
+};
+
+//-----------------------------------------------------------------
+// RAM in a named POSIX shared memory object (/dev/shm/<name>), which
+// other processes can shm_open and mmap (read-only or read-write) to
+// see guest memory live. The object must not already exist (so another
+// process's object is never reused or wiped), and is removed when the
+// memory is destroyed if the name still refers to it (existing
+// mappings remain valid).
+//-----------------------------------------------------------------
+class SharedMemory: public BufferMemory
+{
+public:
+    SharedMemory(const char *name, uint32_t size)
+    {
+        Mem  = NULL;
+        Size = size;
+
+        // Object names start with a single '/'
+        Name = (name[0] == '/') ? name : std::string("/") + name;
+
+        int fd = shm_open(Name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+        {
+            if (errno == EEXIST)
+                fprintf(stderr, "SharedMemory: %s already exists (in use, or left by a crashed run - remove /dev/shm%s)\n", Name.c_str(), Name.c_str());
+            else
+                fprintf(stderr, "SharedMemory: Cannot create %s: %s\n", Name.c_str(), strerror(errno));
+            return ;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && ftruncate(fd, size) == 0)
+        {
+            Dev = st.st_dev;
+            Ino = st.st_ino;
+
+            Mem = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (Mem == MAP_FAILED)
+                Mem = NULL;
+        }
+
+        close(fd);
+
+        // Created above, so ours to remove
+        if (!Mem)
+            shm_unlink(Name.c_str());
+    }
+
+    virtual ~SharedMemory()
+    {
+        if (Mem)
+        {
+            munmap(Mem, Size);
+
+            // Only if the name has not since been reused by someone else
+            int fd = shm_open(Name.c_str(), O_RDONLY, 0);
+            if (fd >= 0)
+            {
+                struct stat st;
+                if (fstat(fd, &st) == 0 && st.st_dev == Dev && st.st_ino == Ino)
+                    shm_unlink(Name.c_str());
+                close(fd);
+            }
+        }
+    }
+
+    virtual void reset(void)
+    {
+        // Release the pages (read back as zero). Mem is always this
+        // instance's own object, even if the name has been reused.
+        if (madvise(Mem, Size, MADV_REMOVE) != 0)
+            memset(Mem, 0, Size);
+    }
+
+private:
+    std::string Name;
+    dev_t       Dev;    // Identity of the object created
+    ino_t       Ino;
+};
+
+//-----------------------------------------------------------------
+// Read-only memory (flash / ROM) shared by all instances in the
+// process. Images are held once per key in a memfd and each instance
+// maps it privately, so pages are shared until written. Writes fault,
+// unless copy-on-write is selected in which case the kernel gives the
+// writing instance its own copy of the page.
+// Images can also be mapped straight from a file (e.g. ELF segments),
+// in which case the page cache holds the one copy for all processes.
+//-----------------------------------------------------------------
+class RomMemory: public BufferMemory
+{
+public:
+    RomMemory(const char *key, const uint8_t *image, uint32_t size, bool cow)
+    {
+        Mem   = NULL;
+        Size  = size;
+        Cow   = cow;
+        Delta = 0;
+
+        int fd = image_fd(key, image, size);
+        if (fd >= 0)
+        {
+            Key = key;
+            Mem = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (Mem == MAP_FAILED)
+                Mem = NULL;
+        }
+    }
+    // Image at offset (any alignment) in a file
+    RomMemory(const char *filename, uint32_t offset, uint32_t size, bool cow)
+    {
+        Mem   = NULL;
+        Size  = size;
+        Cow   = cow;
+        Delta = offset % sysconf(_SC_PAGESIZE);
+
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            return ;
+
+        // Image must be all in the file (no zero fill)
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (uint64_t)offset + size <= (uint64_t)st.st_size)
+        {
+            uint8_t *map = (uint8_t*)mmap(NULL, Delta + size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset - Delta);
+            if (map != MAP_FAILED)
+                Mem = map + Delta;
+        }
+
+        close(fd);
+    }
+
+    virtual ~RomMemory()
+    {
+        if (Mem)
+            munmap(Mem - Delta, Delta + Size);
+        if (!Key.empty())
+            image_release(Key);
+    }
+
+    // Contents are the image
+    virtual void reset(void) { }
+
+    virtual void store(uint32_t address, uint32_t data, int width)
+    {
+        if (Cow)
+            BufferMemory::store(address, data, width);
+    }
+
+    virtual bool read_only(void) { return !Cow; }
+
+private:
+    struct tImage
+    {
+        int      fd;
+        int      refs;
+        uint32_t size;
+    };
+
+    static std::mutex &image_lock(void)
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::map<std::string, tImage> &images(void)
+    {
+        static std::map<std::string, tImage> map;
+        return map;
+    }
+
+    //-----------------------------------------------------------------
+    // image_fd: memfd holding the image for key (created on first use),
+    // one reference taken per call. A key already held with a different
+    // size is refused (mapping past the end of the memfd would SIGBUS).
+    //-----------------------------------------------------------------
+    static int image_fd(const char *key, const uint8_t *image, uint32_t size)
+    {
+        std::lock_guard <std::mutex> guard(image_lock());
+
+        std::map<std::string, tImage>::iterator it = images().find(key);
+        if (it != images().end())
+        {
+            if (it->second.size != size)
+                return -1;
+
+            it->second.refs++;
+            return it->second.fd;
+        }
+
+        int fd = memfd_create("rom", MFD_CLOEXEC);
+        if (fd < 0)
+            return -1;
+
+        uint32_t done = 0;
+        while (done < size)
+        {
+            ssize_t len = write(fd, image + done, size - done);
+            if (len <= 0)
+            {
+                close(fd);
+                return -1;
+            }
+            done += len;
+        }
+
+        tImage entry;
+        entry.fd   = fd;
+        entry.refs = 1;
+        entry.size = size;
+        images()[key] = entry;
+        return fd;
+    }
+
+    //-----------------------------------------------------------------
+    // image_release: Drop a reference, closing the memfd with the last
+    // (existing mappings keep the pages)
+    //-----------------------------------------------------------------
+    static void image_release(const std::string &key)
+    {
+        std::lock_guard <std::mutex> guard(image_lock());
+
+        std::map<std::string, tImage>::iterator it = images().find(key);
+        if (it != images().end() && --it->second.refs == 0)
+        {
+            close(it->second.fd);
+            images().erase(it);
+        }
+    }
+
+    bool        Cow;
+    uint32_t    Delta; // Offset of Mem in the first mapped page
+    std::string Key;   // Image (memfd) reference held, or empty
 };
 
 #endif
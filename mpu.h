@@ -0,0 +1,233 @@
+#ifndef __MPU_H__
+#define __MPU_H__
+
+#include "memory.h"
+
+//-----------------------------------------------------------------
+// Defines
+//-----------------------------------------------------------------
+#define MPU_REGIONS     8
+
+#define MPU_TYPE        (0)  // MPU_TYPE RO  MPU Type Register
+#define MPU_CTRL        (4)  // MPU_CTRL RW  MPU Control Register
+  #define MPU_CTRL_ENABLE         (1 << 0)
+  #define MPU_CTRL_HFNMIENA       (1 << 1)
+  #define MPU_CTRL_PRIVDEFENA     (1 << 2)
+  #define MPU_CTRL_MASK           0x7
+#define MPU_RNR         (8)  // MPU_RNR  RW  MPU Region Number Register
+#define MPU_RBAR        (12) // MPU_RBAR RW  MPU Region Base Address Register
+  #define MPU_RBAR_ADDR_MASK      0xFFFFFF00
+  #define MPU_RBAR_VALID          (1 << 4)
+  #define MPU_RBAR_REGION_MASK    0xF
+#define MPU_RASR        (16) // MPU_RASR RW  MPU Region Attribute and Size Register
+  #define MPU_RASR_ENABLE         (1 << 0)
+  #define MPU_RASR_SIZE_SHIFT     1
+  #define MPU_RASR_SIZE_MASK      0x1F
+  #define MPU_RASR_SRD_SHIFT      8
+  #define MPU_RASR_AP_SHIFT       24
+  #define MPU_RASR_AP_MASK        0x7
+  #define MPU_RASR_XN             (1 << 28)
+  #define MPU_RASR_MASK           0x173FFF3F
+
+// Region changed (-1: control register / everything)
+typedef void (*FP_MPU_CHANGED)(void *arg, int region);
+
+//-----------------------------------------------------------------
+// Mpu: ARMv6-M (PMSAv6) memory protection unit registers.
+// Access checks are made by the CPU, which is told when the
+// configuration changes.
+//-----------------------------------------------------------------
+class Mpu: public Device
+{
+public:
+    Mpu(uint32_t base_addr)
+    {
+        m_changed_cb  = NULL;
+        m_changed_arg = NULL;
+
+        reset();
+    }
+
+    void set_changed_callback(FP_MPU_CHANGED cb, void *arg) { m_changed_cb = cb; m_changed_arg = arg; }
+
+    void reset(void)
+    {
+        m_reg_ctrl = 0;
+        m_reg_rnr  = 0;
+
+        for (int i=0;i<MPU_REGIONS;i++)
+        {
+            m_reg_rbar[i] = 0;
+            m_reg_rasr[i] = 0;
+        }
+
+        changed(-1);
+    }
+
+    void write_reg(uint32_t address, uint32_t data)
+    {
+        switch (address)
+        {
+            case MPU_TYPE:
+            break;
+            case MPU_CTRL:
+                write_ctrl(address, data);
+            break;
+            case MPU_RNR:
+                write_rnr(address, data);
+            break;
+            case MPU_RBAR:
+                write_rbar(address, data);
+            break;
+            case MPU_RASR:
+                write_rasr(address, data);
+            break;
+            default:
+                fprintf(stderr, "MPU: Bad write @ %08x\n", address);
+                exit (-1);
+            break;
+        }
+    }
+    uint32_t read_reg(uint32_t address)
+    {
+        uint32_t data = 0;
+
+        switch (address)
+        {
+            case MPU_TYPE:
+                data = read_type(address);
+            break;
+            case MPU_CTRL:
+                data = m_reg_ctrl;
+            break;
+            case MPU_RNR:
+                data = m_reg_rnr;
+            break;
+            case MPU_RBAR:
+                data = read_rbar(address);
+            break;
+            case MPU_RASR:
+                data = m_reg_rasr[m_reg_rnr];
+            break;
+            default:
+                fprintf(stderr, "MPU: Bad read @ %08x\n", address);
+                exit (-1);
+            break;
+        }
+        return data;
+    }
+
+    // Registers (direct dispatch)
+    uint32_t read_type(uint32_t address) { return MPU_REGIONS << 8; }
+    uint32_t read_rbar(uint32_t address) { return m_reg_rbar[m_reg_rnr] | m_reg_rnr; }
+
+    void write_ctrl(uint32_t address, uint32_t data)
+    {
+        m_reg_ctrl = data & MPU_CTRL_MASK;
+        changed(-1);
+    }
+    void write_rnr(uint32_t address, uint32_t data)
+    {
+        m_reg_rnr = data % MPU_REGIONS;
+    }
+    void write_rbar(uint32_t address, uint32_t data)
+    {
+        // VALID: region number is in the register too
+        if (data & MPU_RBAR_VALID)
+            m_reg_rnr = (data & MPU_RBAR_REGION_MASK) % MPU_REGIONS;
+
+        m_reg_rbar[m_reg_rnr] = data & MPU_RBAR_ADDR_MASK;
+        changed(m_reg_rnr);
+    }
+    void write_rasr(uint32_t address, uint32_t data)
+    {
+        m_reg_rasr[m_reg_rnr] = data & MPU_RASR_MASK;
+        changed(m_reg_rnr);
+    }
+
+    bool mmio_reg(uint32_t offset, tMmioReg *reg)
+    {
+        reg->ctx    = this;
+        reg->offset = offset;
+
+        switch (offset)
+        {
+            case MPU_TYPE:
+                reg->read  = mmio_read<Mpu, &Mpu::read_type>;
+                reg->write = NULL;
+            break;
+            case MPU_CTRL:
+                reg->read  = mmio_read<Mpu, &Mpu::read_reg>;
+                reg->write = mmio_write<Mpu, &Mpu::write_ctrl>;
+            break;
+            case MPU_RNR:
+                reg->read  = mmio_read<Mpu, &Mpu::read_reg>;
+                reg->write = mmio_write<Mpu, &Mpu::write_rnr>;
+            break;
+            case MPU_RBAR:
+                reg->read  = mmio_read<Mpu, &Mpu::read_rbar>;
+                reg->write = mmio_write<Mpu, &Mpu::write_rbar>;
+            break;
+            case MPU_RASR:
+                reg->read  = mmio_read<Mpu, &Mpu::read_reg>;
+                reg->write = mmio_write<Mpu, &Mpu::write_rasr>;
+            break;
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    int save_state(uint32_t *state, int max)
+    {
+        if (max < 2 + (MPU_REGIONS * 2))
+            return 0;
+
+        state[0] = m_reg_ctrl;
+        state[1] = m_reg_rnr;
+        for (int i=0;i<MPU_REGIONS;i++)
+        {
+            state[2 + i*2] = m_reg_rbar[i];
+            state[3 + i*2] = m_reg_rasr[i];
+        }
+        return 2 + (MPU_REGIONS * 2);
+    }
+
+    void restore_state(const uint32_t *state, int len)
+    {
+        if (len < 2 + (MPU_REGIONS * 2))
+            return ;
+
+        m_reg_ctrl = state[0];
+        m_reg_rnr  = state[1] % MPU_REGIONS;
+        for (int i=0;i<MPU_REGIONS;i++)
+        {
+            m_reg_rbar[i] = state[2 + i*2];
+            m_reg_rasr[i] = state[3 + i*2];
+        }
+
+        changed(-1);
+    }
+
+    // Configuration
+    uint32_t get_ctrl(void)     { return m_reg_ctrl; }
+    uint32_t get_rbar(int r)    { return m_reg_rbar[r]; }
+    uint32_t get_rasr(int r)    { return m_reg_rasr[r]; }
+
+private:
+    void changed(int region)
+    {
+        if (m_changed_cb)
+            m_changed_cb(m_changed_arg, region);
+    }
+
+    FP_MPU_CHANGED m_changed_cb;
+    void          *m_changed_arg;
+
+    uint32_t m_reg_ctrl;
+    uint32_t m_reg_rnr;
+    uint32_t m_reg_rbar[MPU_REGIONS];
+    uint32_t m_reg_rasr[MPU_REGIONS];
+};
+
+#endif
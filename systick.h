@@ -43,13 +43,13 @@ public:
         switch (address)
         {
             case SYSTICK_CSR:
-                m_reg_csr = data;                
+                write_csr(address, data);
             break;
             case SYSTICK_RVR:
-                m_reg_reload = data;
+                write_rvr(address, data);
             break;
             case SYSTICK_CVR:
-                m_reg_current = data;
+                write_cvr(address, data);
             break;
             default:
                 fprintf(stderr, "Systick: Bad write @ %08x\n", address);
@@ -64,16 +64,13 @@ public:
         switch (address)
         {
             case SYSTICK_CSR:
-                data = m_reg_csr;
-
-                // Clear overflow flag
-                m_reg_csr &= ~SYSTICK_CSR_COUNTFLAG;
+                data = read_csr(address);
             break;
             case SYSTICK_RVR:
-                data = m_reg_reload;
+                data = read_rvr(address);
             break;
             case SYSTICK_CVR:
-                data = m_reg_current;
+                data = read_cvr(address);
             break;
             case SYSTICK_CALIB:
                 data = 0;
@@ -86,6 +83,51 @@ public:
         return data;
     }
 
+    // Registers (direct dispatch)
+    uint32_t read_csr(uint32_t address)
+    {
+        uint32_t data = m_reg_csr;
+
+        // Clear overflow flag
+        m_reg_csr &= ~SYSTICK_CSR_COUNTFLAG;
+        return data;
+    }
+    uint32_t read_rvr(uint32_t address)                 { return m_reg_reload; }
+    uint32_t read_cvr(uint32_t address)                 { return m_reg_current; }
+    void     write_csr(uint32_t address, uint32_t data) { m_reg_csr = data; }
+    void     write_rvr(uint32_t address, uint32_t data) { m_reg_reload = data; }
+    void     write_cvr(uint32_t address, uint32_t data) { m_reg_current = data; }
+
+    bool mmio_reg(uint32_t offset, tMmioReg *reg)
+    {
+        reg->ctx    = this;
+        reg->offset = offset;
+
+        switch (offset)
+        {
+            case SYSTICK_CSR:
+                reg->read  = mmio_read<Systick, &Systick::read_csr>;
+                reg->write = mmio_write<Systick, &Systick::write_csr>;
+            break;
+            case SYSTICK_RVR:
+                reg->read  = mmio_read<Systick, &Systick::read_rvr>;
+                reg->write = mmio_write<Systick, &Systick::write_rvr>;
+            break;
+            case SYSTICK_CVR:
+                reg->read  = mmio_read<Systick, &Systick::read_cvr>;
+                reg->write = mmio_write<Systick, &Systick::write_cvr>;
+            break;
+            case SYSTICK_CALIB:
+                reg->read  = NULL;
+                reg->write = mmio_write<Systick, &Systick::write_reg>;
+            break;
+            default:
+                // Unimplemented - faults via read_reg / write_reg
+                return false;
+        }
+        return true;
+    }
+
     int clock(void)
     {
         // Systick
@@ -108,6 +150,57 @@ public:
         return irq ? m_irq_number : -1;
     }
 
+    //-----------------------------------------------------------------
+    // clock: Advance by a number of cycles in one go
+    //-----------------------------------------------------------------
+    int clock(uint32_t cycles)
+    {
+        if ((m_reg_csr & SYSTICK_CSR_ENABLE) && cycles)
+        {
+            if (cycles <= m_reg_current)
+                m_reg_current -= cycles;
+            else
+            {
+                // Reached zero and reloaded at least once
+                uint64_t period = (uint64_t)m_reg_reload + 1;
+                cycles -= m_reg_current + 1;
+
+                m_reg_current = m_reg_reload - (uint32_t)(cycles % period);
+                m_reg_csr    |= SYSTICK_CSR_COUNTFLAG;
+
+                if (m_reg_csr & SYSTICK_CSR_TICKINT_EN)
+                    m_irq = true;
+            }
+        }
+
+        bool irq = m_irq;
+        m_irq = false;
+        return irq ? m_irq_number : -1;
+    }
+
+    int save_state(uint32_t *state, int max)
+    {
+        if (max < 4)
+            return 0;
+
+        state[0] = m_irq;
+        state[1] = m_reg_csr;
+        state[2] = m_reg_reload;
+        state[3] = m_reg_current;
+        return 4;
+    }
+
+    void restore_state(const uint32_t *state, int len)
+    {
+        if (len < 4)
+            return ;
+
+        m_irq         = state[0] != 0;
+        m_reg_csr     = state[1];
+        m_reg_reload  = state[2];
+        m_reg_current = state[3];
+    }
+
 private:
     uint32_t m_base_addr;
     int      m_irq_number;
@@ -32,6 +32,15 @@ public:
     {
         return -1;
     }
+
+    bool mmio_reg(uint32_t offset, tMmioReg *reg)
+    {
+        reg->read   = NULL;
+        reg->write  = mmio_write<Sysuart, &Sysuart::write_reg>;
+        reg->ctx    = this;
+        reg->offset = offset;
+        return true;
+    }
 };
 
 #endif